@@ -3,15 +3,24 @@
 
 #include <Arduino.h>
 #include <vector>
+#include <new>
 
 #include "pico/stdlib.h"
 #include "hardware/adc.h"
+#include "hardware/clocks.h"
+#include "hardware/structs/systick.h"
 
 #include "utils.h"
 #include "constants.h"
 #include "hardware.h"
 #include "apps.h"
 #include "dsp.h"
+#include "voices.h"
+#include "registry.h"
+#include "presets.h"
+#include "swar.h"
+#include "quantizer.h"
+#include "pitch.h"
 
 TLWHardware hw;
 
@@ -23,6 +32,15 @@ private:
   int min;
   int max;
   int inc;
+  uint32_t* dirty;
+  uint32_t bit;
+  // the mod matrix's offset; only the audio side writes it, and the value
+  // it is added to is only ever written by the UI
+  volatile int mod;
+  void Store(int val) {
+    if(val != value[0] && dirty != NULL) *dirty |= bit;
+    value[0] = val;
+  }
 public:
   Parameter() = delete;
   Parameter(char* paramName, int* val, int minimum = 0, int maximum = 100, int incAmount = 1) {
@@ -32,18 +50,26 @@ public:
     min = minimum;
     max = maximum;
     inc = incAmount;
+    dirty = NULL;
+    bit = 0;
+    mod = 0;
+  }
+  // edits through Increase/Set flag bit in *dirty
+  void Watch(uint32_t* dirty, uint32_t bit) {
+    this->dirty = dirty;
+    this->bit = bit;
   }
   void Increase(int val) {
     val = val * inc;
     val += value[0];
     if(val>max) val = min;
     if(val<min) val = max;
-    value[0] = val;
+    Store(val);
   }
   void Set(int val) {
     if(val>max) val = min;
     if(val<min) val = max;
-    value[0] = val;
+    Store(val);
   }
   int Get() {
     return value[0];
@@ -52,27 +78,320 @@ public:
     return name;
   }
   bool HasChanged() {
-    bool result = lastValue == value[0];
+    bool result = lastValue != value[0];
     lastValue = value[0];
     return result;
   }
+  int Range() {
+    return max - min;
+  }
+  // control lane: sets the offset, returns whether it moved
+  bool AUDIO_FUNC(Modulate)(int amount) {
+    if(amount == mod) return false;
+    mod = amount;
+    return true;
+  }
+  // base plus the offset, held to the range; for state the audio side keeps
+  // its own copy of, like Harnomia's
+  int AUDIO_FUNC(Apply)(int base) {
+    int val = base + mod;
+    if(val > max) val = max;
+    if(val < min) val = min;
+    return val;
+  }
+  // what whoever uses the value reads in place of Get
+  int AUDIO_FUNC(Modulated)() {
+    return Apply(value[0]);
+  }
+};
+
+// Parameters are kept in place rather than in a vector, so the mod matrix
+// can index them from the audio side without a reallocation under it. Every
+// app and word slot carries the whole list, so it's sized to the most any
+// app adds (Harnomia and OutputCalibrator, 10)
+#define MAX_PARAMS 10
+
+class ParamList {
+private:
+  alignas(Parameter) uint8_t storage[MAX_PARAMS*sizeof(Parameter)];
+  int count;
+public:
+  ParamList() {
+    count = 0;
+  }
+  int size() {
+    return count;
+  }
+  Parameter& operator[](int i) {
+    return ((Parameter*)storage)[i];
+  }
+  Parameter& back() {
+    return (*this)[count-1];
+  }
+  bool push_back(const Parameter& p) {
+    if(count >= MAX_PARAMS) return false;
+    new (&storage[count*sizeof(Parameter)]) Parameter(p);
+    count++;
+    return true;
+  }
 };
 
+// Mod matrix: routes from the CV inputs, the words' outputs and two LFOs to
+// parameters, by the index of the word that owns them (MOD_OWNER_APP for the
+// running app) and their index in its params. Run once a control block ahead
+// of the app; each route adds source times depth times the parameter's range
+// to it. Sources are centred on 0V: the jacks and the outputs in calibrated
+// volts over WORD_MAX_VOLTS, the LFOs -1 to 1, so a depth means the same
+// swing from any of them. At most MOD_ROUTES routes and twice that many
+// parameters are touched a block, so its cost is bounded whatever the routing.
+
+#define MOD_ROUTES 8
+#define MOD_OWNER_APP -1
+typedef enum {
+  MOD_CV1, MOD_CV2, MOD_CV3,
+  MOD_OUT1V, MOD_OUT1C, MOD_OUT2V, MOD_OUT2C, MOD_OUT3V, MOD_OUT3C,
+  MOD_LFO1, MOD_LFO2,
+  NUM_MOD_SOURCES
+} ModSource;
+const char* const MOD_SOURCE_NAMES[NUM_MOD_SOURCES] = {
+  "cv1", "cv2", "cv3", "v1", "c1", "v2", "c2", "v3", "c3", "lfo1", "lfo2"
+};
+
+struct ModRoute {
+  int8_t source;
+  int8_t owner;
+  uint8_t param;
+  // of the parameter's range at full source, Q14; 0 leaves the slot free
+  fp_signed depth;
+};
+
+class App;
+class ModMatrix {
+public:
+  ModRoute routes[MOD_ROUTES];
+  // parameters modulated last block, so one whose routes have gone is put
+  // back to its base before it's dropped
+  struct Target {
+    int8_t owner;
+    uint8_t param;
+    int32_t sum;
+  } targets[2*MOD_ROUTES];
+  int numTargets;
+  fp_signed sources[NUM_MOD_SOURCES];
+  // 0.5Hz and 0.125Hz triangles
+  PhasorAt<CONTROLRATE> lfos[2];
+  App* volatile host;
+  ModMatrix() {
+    Clear();
+    numTargets = 0;
+    for(int i=0;i<NUM_MOD_SOURCES;i++) sources[i] = 0;
+    lfos[0].delta = PhasorAt<CONTROLRATE>::DELTA/2;
+    lfos[1].delta = PhasorAt<CONTROLRATE>::DELTA/8;
+    host = NULL;
+  }
+  // routes are only ever changed whole, with the audio side held off, so a
+  // block never runs a route that is half edited
+  void Write(int r, const ModRoute& route) {
+    uint32_t ints = save_and_disable_interrupts();
+    routes[r] = route;
+    restore_interrupts(ints);
+  }
+  void Clear() {
+    ModRoute empty = {0, 0, 0, 0};
+    for(int r=0;r<MOD_ROUTES;r++) Write(r, empty);
+  }
+  // a word's routes go when it's replaced
+  void Forget(int owner) {
+    for(int r=0;r<MOD_ROUTES;r++) {
+      if(routes[r].owner != owner) continue;
+      ModRoute route = routes[r];
+      route.depth = 0;
+      Write(r, route);
+    }
+  }
+  int Find(int source, int owner, int param) {
+    for(int r=0;r<MOD_ROUTES;r++) {
+      ModRoute& route = routes[r];
+      if(route.depth != 0 && route.source == source && route.owner == owner && route.param == param) return r;
+    }
+    return -1;
+  }
+  fp_signed Depth(int source, int owner, int param) {
+    int r = Find(source, owner, param);
+    return r < 0 ? 0 : routes[r].depth;
+  }
+  // takes a free slot for a new route
+  bool SetDepth(int source, int owner, int param, fp_signed depth) {
+    int r = Find(source, owner, param);
+    if(r < 0 && depth == 0) return true;
+    if(r < 0) {
+      for(r=0;r<MOD_ROUTES && routes[r].depth != 0;r++);
+      if(r == MOD_ROUTES) return false;
+    }
+    ModRoute route = {(int8_t)source, (int8_t)owner, (uint8_t)param, depth};
+    Write(r, route);
+    return true;
+  }
+
+  void SavePreset(PresetWriter& w) {
+    int n = 0;
+    for(int r=0;r<MOD_ROUTES;r++) if(routes[r].depth != 0) n++;
+    w.Put<uint8_t>(n);
+    for(int r=0;r<MOD_ROUTES;r++) {
+      if(routes[r].depth == 0) continue;
+      w.Put<int8_t>(routes[r].source);
+      w.Put<int8_t>(routes[r].owner);
+      w.Put<uint8_t>(routes[r].param);
+      w.Put<int16_t>(routes[r].depth);
+    }
+  }
+  // presets from before the matrix end early and leave it empty
+  void LoadPreset(PresetReader& r) {
+    Clear();
+    int n = min(MOD_ROUTES, (int)r.Get<uint8_t>());
+    for(int i=0;i<n && r.ok;i++) {
+      int source = r.Get<int8_t>();
+      int owner = r.Get<int8_t>();
+      int param = r.Get<uint8_t>();
+      fp_signed depth = r.Get<int16_t>();
+      if(r.ok && source >= 0 && source < NUM_MOD_SOURCES) SetDepth(source, owner, param, depth);
+    }
+  }
+  Parameter* Resolve(App* app, int owner, int param, App** target);
+  void Process(App* app);
+};
+ModMatrix mods;
+
+// Words' outputs as inputs to other words without the trip out through PWM
+// and back in through the ADC. Every output keeps the voltage it is putting
+// out (AnalogOut::patchVolts), so a word publishes by setting its outputs as
+// usual; patch[w] puts one of those in place of word w's CV jack, read back
+// through w's own input calibration so it matches what a cable would give.
+// Words run a sample at a time, so ThreeLittleWords orders them to run a
+// word's source before it and the value is the same sample's; only a word in
+// a loop reads its source a sample late.
+//
+// Clocks go the same way: clock[w] is PATCH_JACK for word w's own trigger
+// input, or another word whose ticks it steps on instead. A CLOCK word
+// counts its ticks in ticks[], and a word on it sees an edge whenever the
+// count has moved since it last looked.
+
+#define PATCH_JACK -1
+#define NUM_PATCH_SOURCES (2*NUM_WORDS)
+const char* const PATCH_SOURCE_NAMES[NUM_PATCH_SOURCES] = {"v1", "c1", "v2", "c2", "v3", "c3"};
+const char* const PATCH_CLOCK_NAMES[NUM_WORDS] = {"w1", "w2", "w3"};
+class PatchBus {
+public:
+  // PATCH_JACK, or 2*word for its v/oct out and 2*word+1 for its cv out
+  volatile int8_t patch[NUM_WORDS];
+  // PATCH_JACK, or the word whose ticks clock this one
+  volatile int8_t clock[NUM_WORDS];
+  volatile uint32_t ticks[NUM_WORDS];
+  // bumped by every change, for the audio side to sort the words again
+  volatile uint32_t version;
+  // set by the sort: word reads its source from the sample before
+  volatile bool late[NUM_WORDS];
+  PatchBus() {
+    version = 0;
+    for(int i=0;i<NUM_WORDS;i++) ticks[i] = 0;
+    Clear();
+  }
+  void Clear() {
+    for(int i=0;i<NUM_WORDS;i++) {
+      patch[i] = PATCH_JACK;
+      clock[i] = PATCH_JACK;
+      late[i] = false;
+    }
+    version++;
+  }
+  void Set(int word, int source) {
+    patch[word] = source;
+    version++;
+  }
+  void SetClock(int word, int source) {
+    clock[word] = source;
+    version++;
+  }
+  // the word whose output feeds word's input, or -1
+  int SourceWord(int word) {
+    return patch[word] == PATCH_JACK ? -1 : patch[word] >> 1;
+  }
+  // the word clocking word, or -1 for its own trigger input
+  int ClockWord(int word) {
+    return clock[word];
+  }
+  AnalogOut* AUDIO_FUNC(Output)(int source) {
+    return (source & 1) ? hw.cvOut[source >> 1] : hw.voctOut[source >> 1];
+  }
+  // what word's CV input reads, in the ADC's units
+  fp_signed AUDIO_FUNC(In)(int word) {
+    int source = patch[word];
+    if(source == PATCH_JACK) return hw.analogIn[word];
+    return hw.calibration.inputs[word].Inverse(Output(source)->patchVolts);
+  }
+  // the same in calibrated volts (FP)
+  fp_signed AUDIO_FUNC(Volts)(int word) {
+    int source = patch[word];
+    if(source == PATCH_JACK) return hw.InputVoltsFP(word);
+    return Output(source)->patchVolts;
+  }
+  void SavePreset(PresetWriter& w) {
+    for(int i=0;i<NUM_WORDS;i++) w.Put<int8_t>(patch[i]);
+    for(int i=0;i<NUM_WORDS;i++) w.Put<int8_t>(clock[i]);
+  }
+  void LoadPreset(PresetReader& r) {
+    Clear();
+    for(int i=0;i<NUM_WORDS;i++) {
+      int source = r.Get<int8_t>();
+      if(r.ok && source >= PATCH_JACK && source < NUM_PATCH_SOURCES) Set(i, source);
+    }
+    for(int i=0;i<NUM_WORDS;i++) {
+      int source = r.Get<int8_t>();
+      if(r.ok && source >= PATCH_JACK && source < NUM_WORDS) SetClock(i, source);
+    }
+  }
+};
+PatchBus patchBus;
+
 class App {
 public:
-  enum ParameterState { Modify, Select };
-  std::vector<Parameter> params;
+  enum ParameterState { Modify, Select, Mod };
+  ParamList params;
   int paramIndices[NUM_WORDS];
   ParameterState paramStates [NUM_WORDS];
+  // one bit per parameter, in the order they were added
+  uint32_t dirtyParams;
+  // the same for parameters the mod matrix has moved, for apps that build
+  // their state from the parameters on the UI side; see ParamsModulated
+  volatile uint32_t modulatedParams;
   App() {
     for(int i=0;i<NUM_WORDS;i++) {
       paramIndices[i] = 0;
       paramStates[i] = Modify;
     }
+    dirtyParams = 0;
+    modulatedParams = 0;
   }
+  virtual ~App() {}
+
+  // apps that host words hand them out here, for the mod matrix to reach
+  // their parameters
+  virtual App* Word(int i) { return NULL; }
 
-  void AddParam(char* paramName, int* param, int min = 0, int max = 100, int incAmount = 1) {
-    params.push_back(Parameter(paramName, param, min, max, incAmount));
+  // returns the parameter's bit in the mask handed to ParamsChanged
+  uint32_t AddParam(char* paramName, int* param, int min = 0, int max = 100, int incAmount = 1) {
+    uint32_t bit = 1u << params.size();
+    if(!params.push_back(Parameter(paramName, param, min, max, incAmount))) return 0;
+    params.back().Watch(&dirtyParams, bit);
+    return bit;
+  }
+
+  // the mod matrix moved these parameters' offsets, called on the audio side
+  // just before ProcessControl. Apps that read Modulated() there, as the
+  // words do, have nothing to do; by default the change goes to the UI loop's
+  // DispatchParamChanges like an edit, for apps that rebuild on that side
+  virtual void AUDIO_FUNC(ParamsModulated)(uint32_t changed) {
+    modulatedParams |= changed;
   }
 
   void UpdateParams() {
@@ -80,7 +399,7 @@ public:
       for(int i=0;i<NUM_WORDS;i++) {
         int controlDelta = hw.control[i]->GetDelta();
         if(hw.control[i]->encButtonPressed()) {
-          paramStates[i] = paramStates[i] == Modify ? Select : Modify;
+          paramStates[i] = (ParameterState)((paramStates[i] + 1) % (Mod + 1));
         }
         if(controlDelta != 0) {
           switch(paramStates[i]) {
@@ -92,6 +411,13 @@ public:
               while(paramIndices[i] < 0) paramIndices[i] += params.size();
               while(paramIndices[i] >= params.size()) paramIndices[i] -= params.size();
               break;
+            case Mod: {
+              // how far this column's CV input moves the parameter, in percent
+              int percent = (mods.Depth(MOD_CV1 + i, MOD_OWNER_APP, paramIndices[i])*100 + (FP_UNITY>>1)) >> FP_BITS;
+              percent = max(-100, min(100, percent + controlDelta));
+              mods.SetDepth(MOD_CV1 + i, MOD_OWNER_APP, paramIndices[i], (percent*FP_UNITY)/100);
+              break;
+            }
             default:
               paramStates[i] = Modify;
           }
@@ -101,17 +427,49 @@ public:
   }
 
   bool ParamsHaveChanged() {
-    bool changed = false;
-    for(int i=0;i<params.size();i++) {
-      changed |= params[i].HasChanged();
-    }
-    return changed;
+    return dirtyParams != 0;
+  }
+
+  // the loop hands over the parameters edited since the last call, or
+  // moved by a mod route; apps that only need to redo part of their derived
+  // state look at the mask. A frame with neither calls nothing, so how often
+  // UpdateInternals runs goes with the edits and the modulation, not the
+  // frame rate
+  void DispatchParamChanges() {
+    uint32_t changed = dirtyParams;
+    dirtyParams = 0;
+    uint32_t ints = save_and_disable_interrupts();
+    changed |= modulatedParams;
+    modulatedParams = 0;
+    restore_interrupts(ints);
+    if(changed != 0) ParamsChanged(changed);
+  }
+  virtual void ParamsChanged(uint32_t changed) {
+    UpdateInternals();
   }
 
+  // called on the UI loop before UpdateParams, for apps that hand their
+  // parameters to audio through a Seqlock and take changes back from it
+  virtual void SyncParams() {}
+
   virtual void UpdateInternals() {
 
   }
 
+  // preset data; apps with state beyond their Parameters add it after these.
+  // loading goes through Set, so the usual change handling picks it up
+  virtual void SavePreset(PresetWriter& w) {
+    w.Put<uint8_t>(params.size());
+    for(int i=0;i<params.size();i++) w.Put<int32_t>(params[i].Get());
+  }
+  virtual void LoadPreset(PresetReader& r) {
+    int n = r.Get<uint8_t>();
+    for(int i=0;i<n;i++) {
+      int32_t v = r.Get<int32_t>();
+      if(i < params.size()) params[i].Set(v);
+    }
+  }
+
   virtual void DrawParams() {
     if(params.size() > 0) {
       hw.display->setFont(u8g2_font_threepix_tr);
@@ -121,6 +479,13 @@ public:
       hw.display->drawVLine(127*2/3,63-5,6);
       for(int i=0;i<NUM_WORDS;i++) {
         if(paramStates[i] == Select) hw.display->drawStr(i*128/3 + 2, 63-7, "+");
+        if(paramStates[i] == Mod) {
+          char buffer[32];
+          int percent = (mods.Depth(MOD_CV1 + i, MOD_OWNER_APP, paramIndices[i])*100 + (FP_UNITY>>1)) >> FP_BITS;
+          sprintf(buffer, "%s ~%d", params[paramIndices[i]].GetName(), percent);
+          hw.display->drawStr(i*128/3 + 2, 63-6, buffer);
+          continue;
+        }
         hw.display->drawStr(i*128/3 + 7, 63-6, params[paramIndices[i]].GetName());
       }
       hw.display->setDrawColor(1);
@@ -132,9 +497,147 @@ public:
   virtual void DecParam() {}
   virtual void IncParam() {}
   virtual void UpdateDisplay() {}
-  virtual void Process() {}
+  // control lane, called every CONTROL_BLOCK samples just before Process();
+  // work that only follows knobs and CV belongs here rather than per sample
+  virtual void AUDIO_FUNC(ProcessControl)() {}
+  virtual void AUDIO_FUNC(Process)() {}
 };
 
+Parameter* ModMatrix::Resolve(App* app, int owner, int param, App** target) {
+  *target = owner == MOD_OWNER_APP ? app : app->Word(owner);
+  if(*target == NULL || param >= (*target)->params.size()) return NULL;
+  return &(*target)->params[param];
+}
+
+void AUDIO_FUNC(ModMatrix::Process)(App* app) {
+  host = app;
+  for(int i=0;i<NUM_WORDS;i++) {
+    sources[MOD_CV1 + i] = hw.InputVoltsFP(i)/WORD_MAX_VOLTS;
+    sources[MOD_OUT1V + 2*i] = hw.voctOut[i]->patchVolts/WORD_MAX_VOLTS;
+    sources[MOD_OUT1C + 2*i] = hw.cvOut[i]->patchVolts/WORD_MAX_VOLTS;
+  }
+
+  for(int i=0;i<2;i++) {
+    uint32_t phase = lfos[i].Process();
+    sources[MOD_LFO1 + i] = (fp_signed)((phase ^ ((int32_t)phase >> 31)) >> (31 - FP_BITS - 1)) - FP_UNITY;
+  }
+  for(int t=0;t<numTargets;t++) targets[t].sum = 0;
+  for(int r=0;r<MOD_ROUTES;r++) {
+    ModRoute& route = routes[r];
+    if(route.depth == 0) continue;
+    App* target;
+    Parameter* param = Resolve(app, route.owner, route.param, &target);
+    if(param == NULL) continue;
+    int t = 0;
+    while(t < numTargets && (targets[t].owner != route.owner || targets[t].param != route.param)) t++;
+    if(t == numTargets) {
+      targets[t].owner = route.owner;
+      targets[t].param = route.param;
+      targets[t].sum = 0;
+      numTargets++;
+    }
+    fp_signed amount = FP_MUL(sources[route.source], route.depth);
+    targets[t].sum += (int32_t)(((int64_t)amount * param->Range()) >> FP_BITS);
+  }
+  int kept = 0;
+  for(int t=0;t<numTargets;t++) {
+    App* target;
+    Parameter* param = Resolve(app, targets[t].owner, targets[t].param, &target);
+    if(param != NULL && param->Modulate(targets[t].sum)) {
+      target->ParamsModulated(1u << targets[t].param);
+    }
+    if(targets[t].sum != 0) targets[kept++] = targets[t];
+  }
+  numTargets = kept;
+}
+
+// Runs the outgoing and incoming app side by side for CROSSFADE_MS. Audio
+// writes from both are captured and mixed on a linear ramp; CV, volts and
+// raw writes go straight out, so the incoming app's simply win.
+class Crossfade {
+public:
+  App* volatile from;
+  App* to;
+  AnalogOut* outs[2*NUM_WORDS];
+  fp_signed fromFP[2*NUM_WORDS];
+  bool fromWrote[2*NUM_WORDS];
+  int numOuts;
+  int remaining;
+  fp_signed gain;
+  fp_signed gainDelta;
+  // time spent in Process() over the last fade, for both apps and the mix
+  uint32_t busyUs;
+  uint32_t samples;
+  // the cost of the fade that ended last, of any Crossfade, held until
+  // audioReport prints it
+  static volatile int lastCostPercent;
+  static volatile bool costToReport;
+  Crossfade() {
+    from = NULL;
+    to = NULL;
+    numOuts = 0;
+    remaining = 0;
+    gain = 0;
+    gainDelta = 0;
+    busyUs = 0;
+    samples = 0;
+  }
+  bool Active() { return from != NULL; }
+  void Start(App* from, App* to, AnalogOut** outs, int n) {
+    this->to = to;
+    numOuts = n;
+    for(int i=0;i<n;i++) {
+      this->outs[i] = outs[i];
+      outs[i]->capture = true;
+    }
+    remaining = (SAMPLERATE*CROSSFADE_MS)/1000;
+    gainDelta = FP_UNITY/remaining;
+    gain = 0;
+    busyUs = 0;
+    samples = 0;
+    this->from = from;
+  }
+  void AUDIO_FUNC(ProcessControl)() {
+    from->ProcessControl();
+    to->ProcessControl();
+  }
+  void AUDIO_FUNC(Process)() {
+    uint32_t start = time_us_32();
+    for(int i=0;i<numOuts;i++) outs[i]->captured = false;
+    // reading an edge clears it, so both sides start from the trigger
+    // inputs as they were and see the same edges
+    GateTrigger triggers[NUM_WORDS];
+    for(int i=0;i<NUM_WORDS;i++) triggers[i] = *hw.trigIn[i];
+    from->Process();
+    for(int i=0;i<NUM_WORDS;i++) *hw.trigIn[i] = triggers[i];
+    for(int i=0;i<numOuts;i++) {
+      fromWrote[i] = outs[i]->captured;
+      fromFP[i] = outs[i]->capturedFP;
+      outs[i]->captured = false;
+    }
+    to->Process();
+    gain += gainDelta;
+    for(int i=0;i<numOuts;i++) {
+      if(!outs[i]->captured) continue;
+      fp_signed v = FP_MUL(outs[i]->capturedFP, gain);
+      if(fromWrote[i]) v += FP_MUL(fromFP[i], FP_UNITY - gain);
+      outs[i]->SetAudioLevel(outs[i]->AudioLevel(v));
+    }
+    busyUs += time_us_32() - start;
+    samples++;
+    if(--remaining <= 0) {
+      for(int i=0;i<numOuts;i++) outs[i]->capture = false;
+      from = NULL;
+      lastCostPercent = CostPercent();
+      costToReport = true;
+    }
+  }
+  // share of the sample period the overlap took
+  int AUDIO_FUNC(CostPercent)() { return samples > 0 ? (busyUs*100)/(samples*TIMER_INTERVAL) : 0; }
+};
+volatile int Crossfade::lastCostPercent = 0;
+volatile bool Crossfade::costToReport = false;
+
 class Info : public App {
 public:
   Info(int x, int y, int width, int height, int len) {
@@ -143,7 +646,7 @@ public:
     char buffer[32];
   }
 
-  void Process() {
+  void AUDIO_FUNC(Process)() {
   }
 };
 
@@ -173,7 +676,7 @@ public:
   int leadSeq[14] = {7,12,3,0,3,5,12,7,12,7,5,12,7,12};
   int bassSeq[2] = {0,3};
   fp_signed semitone = FP_UNITY/12;
-  void Process() {
+  void AUDIO_FUNC(Process)() {
     if(trig->Process()) {
       hw.voctOut[0]->SetCVFP(semitone*(leadSeq[leadSeqIndex]+fifths));
       hw.voctOut[1]->SetCVFP(semitone*(bassSeq[bassSeqIndex]+fifths));
@@ -216,7 +719,7 @@ public:
     }
     writtenSamples = 0;
   }
-  void Process() {
+  void AUDIO_FUNC(Process)() {
     if(writtenSamples < 32) {
       if(phase<1) {
         buf[bufIndex] = hw.analogIn[0];
@@ -230,28 +733,99 @@ public:
   }
 };
 
+// Tracks the pitch of an audio input on in 1 and sends it out as V/oct on
+// the first voct out, with a gate on the first cv out while there's a pitch.
+// yin picks the tracker; win sets YIN's window, trading latency and ISR time
+// for how low it hears. The display times the whole analysis of one frame
+// at each window so the choice can be made on the module.
+#define PITCH_NUM_WINDOWS 3
+const int PITCH_WINDOWS[PITCH_NUM_WINDOWS] = {64, 128, 256};
 class NoteDetector : public App {
 public:
-  fp_signed voltage;
-  OnePoleLP* lp;
+  enum { PARAM_YIN, PARAM_WIN };
+  ZeroCrossingPitch zc;
+  YinPitch yin;
+  int useYin;
+  int windowIndex;
+  int builtWindow;
+  uint32_t zcPeriod;
+  uint32_t yinPeriod;
+  fp_signed volts;
+  double frameCycles[PITCH_NUM_WINDOWS];
+  int frames;
   NoteDetector() {
-    voltage = 0;
-    lp = new OnePoleLP(FLOAT2FP(0.001));
-  }
-  ~NoteDetector() {
-    delete lp;
+    useYin = 1;         AddParam("yin", &useYin, 0, 1);
+    windowIndex = 2;    AddParam("win", &windowIndex, 0, PITCH_NUM_WINDOWS-1);
+    builtWindow = windowIndex;
+    yin.SetWindow(PITCH_WINDOWS[windowIndex]);
+    zcPeriod = 0;
+    yinPeriod = 0;
+    volts = 0;
+    for(int i=0;i<PITCH_NUM_WINDOWS;i++) frameCycles[i] = 0;
+    frames = 0;
+  }
+  void Measure(int reps) {
+    static YinPitch bench;
+    static int16_t frame[2*PITCH_MAX_WINDOW];
+    // the audio side swaps the frames and changes the window under this
+    uint32_t irq = save_and_disable_interrupts();
+    int window = yin.window;
+    memcpy(frame, yin.analysis, sizeof(frame[0])*2*window);
+    restore_interrupts(irq);
+    for(int i=2*window;i<2*PITCH_MAX_WINDOW;i++) frame[i] = frame[i - window];
+    for(int i=0;i<PITCH_NUM_WINDOWS;i++) {
+      bench.SetWindow(PITCH_WINDOWS[i]);
+      uint32_t best = 0xFFFFFFFF;
+      for(int r=0;r<reps;r++) {
+        uint32_t start = time_us_32();
+        bench.Analyze(frame);
+        best = min(best, time_us_32() - start);
+      }
+      frameCycles[i] = best*(clock_get_hz(clk_sys)/1000000.0);
+    }
   }
   void UpdateDisplay() {
-    char buffer[32];
-    sprintf(buffer, "%f", round((FP2FLOAT(voltage)*10.68-5.29)*12));
-    hw.display->drawStr(24, 24, buffer);
+    // audio interrupts the runs, which the best-of takes care of
+    if(frames++ % 32 == 0) Measure(4);
+    char buffer[64];
+    hw.display->setFont(u8g2_font_missingplanet_tf);
+    sprintf(buffer, "zc %.1fHz %s", zcPeriod ? (SAMPLERATE*256.0)/zcPeriod : 0.0, useYin ? "" : "*");
+    hw.display->drawStr(0, 0, buffer);
+    sprintf(buffer, "yin %.1fHz %s", yinPeriod ? (SAMPLERATE*256.0)/yinPeriod : 0.0, useYin ? "*" : "");
+    hw.display->drawStr(0, 10, buffer);
+    sprintf(buffer, "out %.3fV", FP2FLOAT(volts));
+    hw.display->drawStr(0, 20, buffer);
+    for(int i=0;i<PITCH_NUM_WINDOWS;i++) {
+      sprintf(buffer, "w%d %.0fk cyc %dms %s", PITCH_WINDOWS[i], frameCycles[i]/1000.0,
+        (4*PITCH_WINDOWS[i]*PITCH_DECIMATION*1000)/SAMPLERATE, i == builtWindow ? "*" : "");
+      hw.display->drawStr(0, 30 + 8*i, buffer);
+    }
   }
-  void Process() {
-    voltage = lp->Process(hw.analogIn[0]);
+  void AUDIO_FUNC(ProcessControl)() {
+    int window = params[PARAM_WIN].Modulated();
+    if(window != builtWindow) {
+      builtWindow = window;
+      yin.SetWindow(PITCH_WINDOWS[builtWindow]);
+    }
+    zcPeriod = zc.Period();
+    yinPeriod = yin.period;
+    uint32_t period = params[PARAM_YIN].Modulated() ? yinPeriod : zcPeriod;
+    if(period != 0) volts = max(0, min(WORD_MAX_VOLTS<<FP_BITS, periodToVolts(period)));
+    hw.voctOut[0]->SetVoltsFP(volts);
+    hw.cvOut[0]->SetVoltsFP(period != 0 ? WORD_MAX_VOLTS<<FP_BITS : 0);
+  }
+  void AUDIO_FUNC(Process)() {
+    zc.Process(hw.analogIn[0]);
+    yin.Process(hw.analogIn[0]);
   }
 };
 
-class Harnomia : public App {
+#define HARNOMIA_NUM_XFORMS 8
+const char AUDIO_DATA HARNOMIA_XFORMS[HARNOMIA_NUM_XFORMS] = {'<','>','v','^','-','+','o','?'};
+
+// everything the audio side needs from the UI, handed over as a whole so a
+// change to edo, tones and root together is never seen half done
+class Harmony {
 public:
   int edo;
   int tones;
@@ -259,66 +833,200 @@ public:
   int color;
   int root;
   int inverted;
+  int xformTriggers[NUM_WORDS];
+  int mixOut;
+  int freqsEdo;
   fp_signed invEdo;
-  fp_signed freqs[99];
-  Saw* oscs[NUM_WORDS];
+  fp_signed freqs[MAX_EDO];
+
+  int AUDIO_FUNC(wrapVal)(int x, int max) {
+    while(x<0) x+=max;
+    while(x>=max) x-=max;
+    return x;
+  }
+
+  int AUDIO_FUNC(getColor)() {
+    return inverted ? harmonic-color : color;
+  }
+
+  // 4*261.63Hz*2^(note/edo), for notes within the octave
+  fp_signed AUDIO_FUNC(noteToFreq)(int note) {
+    return (twoexp((note << FP_BITS)/edo)*4186) >> (LUT_BITS + 2);
+  }
+
+  // the table only needs redoing when edo moves; it's cheap enough to do on
+  // the audio side when modulation moves edo
+  void AUDIO_FUNC(UpdateTables)() {
+    invEdo = FP_UNITY/edo;
+    if(freqsEdo != edo) {
+      for(int i=0;i<edo;i++) {
+        freqs[i] = noteToFreq(i);
+      }
+      freqsEdo = edo;
+    }
+  }
+
+  void AUDIO_FUNC(Transform)(char xform) {
+    switch(xform) {
+      case '<':
+        inverted = inverted ? 0 : 1;
+        root -= getColor();
+        break;
+      case '>':
+        root += getColor();
+        inverted = inverted ? 0 : 1;
+        break;
+      case 'v':
+        root -= 1;
+        break;
+      case '^':
+        root += 1;
+        break;
+      case '-':
+        color -= 1;
+        break;
+      case '+':
+        color += 1;
+        break;
+      case 'o':
+        root = 0;
+        color = 4;
+        break;
+      case '?':
+        Transform(HARNOMIA_XFORMS[rand()%(HARNOMIA_NUM_XFORMS-2)]);
+        break;
+    }
+    edo       = max(wrapVal(edo, 99), 2);
+    tones     = max(wrapVal(tones, edo), 1);
+    root      = wrapVal(root, edo);
+    harmonic  = max(wrapVal(harmonic, edo), 2);
+    color     = max(wrapVal(color, harmonic), 1);
+  }
+
+  int AUDIO_FUNC(getInterval)(int index) {
+    return harmonic*(index>>1) + (index&0x1 ? getColor() : 0);
+  }
+
+  int AUDIO_FUNC(indexToKey)(int index) {
+    int octave = index/tones;
+    int tone = (root + getInterval(index - octave*tones));
+    while(tone>=edo) tone-=edo;
+    return octave*edo + tone;
+  }
+
+  fp_signed AUDIO_FUNC(keyToFreq)(int key) {
+    return (freqs[key%edo]<<(key/edo))>>2;
+  }
+
+  fp_signed getFreq(fp_signed index) {
+    int octave = index/tones;
+    return freqs[getInterval(index - octave*tones) % edo]<<octave;
+  }
+
+  fp_signed getVoct(fp_signed index) {
+    int octave = index/tones;
+    return invEdo*(getInterval(index - octave*tones) % edo)<<octave;
+  }
+};
+
+// The UI edits ui and publishes it in UpdateInternals; audio picks it up
+// into plain at the next control block. Transforms from the trigger inputs
+// happen on plain and are reported back so the UI edits on top of them.
+// What plays is cur, plain with the mod matrix's offsets added, rebuilt on
+// the audio side whenever either moves.
+class Harnomia : public App {
+public:
+  // in AddParam order
+  enum {
+    PARAM_EDO, PARAM_TONES, PARAM_HARMONIC, PARAM_COLOR, PARAM_ROOT,
+    PARAM_INVERTED, PARAM_XFORM, PARAM_MIX = PARAM_XFORM + NUM_WORDS
+  };
+  Harmony ui;
+  Harmony plain;
+  Harmony cur;
+  bool modsMoved;
+  Seqlock<Harmony> toAudio;
+  Seqlock<Harmony> toUI;
+  uint32_t audioSeq;
+  uint32_t uiSeq;
+  uint32_t edoParam;
+  VoicePool<NUM_VOICES> pool;
+  // chord tones the pool had room for at the last update, for the display
+  volatile int chordVoices;
+  int outputKeys[NUM_WORDS];
+  int outputVoices[NUM_WORDS];
   Metronome cvMetro;
-  int xformTriggers[NUM_WORDS];
-  char xforms[8] = {'<','>','v','^','-','+','o','?'};
-  int numXforms;
   Trigger* analogTriggers[NUM_WORDS];
   int voiceIndex[NUM_WORDS];
   int selectedVoice;
   Harnomia() {
-    this->edo       = 12;         AddParam("edo", &edo, 2, 99);
-    this->tones     = 3;          AddParam("tones", &tones, 1, 99);
-    this->harmonic  = 7;          AddParam("harmonic", &harmonic, 1, 99);
-    this->color     = 4;          AddParam("color", &color, 1, 99);
-    this->root      = 0;          AddParam("root", &root, 0, 99);
-    this->inverted  = false;      AddParam("inverted", &inverted, 0, 1);
-    this->xformTriggers[0] = 0;   AddParam("xformI", &xformTriggers[0], 0, 7);
-    this->xformTriggers[1] = 3;   AddParam("xformII", &xformTriggers[1], 0, 7);
-    this->xformTriggers[2] = 6;   AddParam("xformIII", &xformTriggers[2], 0 ,7);
+    ui.edo       = 12;            edoParam = AddParam("edo", &ui.edo, 2, MAX_EDO);
+    ui.tones     = 3;             AddParam("tones", &ui.tones, 1, 99);
+    ui.harmonic  = 7;             AddParam("harmonic", &ui.harmonic, 1, 99);
+    ui.color     = 4;             AddParam("color", &ui.color, 1, 99);
+    ui.root      = 0;             AddParam("root", &ui.root, 0, 99);
+    ui.inverted  = false;         AddParam("inverted", &ui.inverted, 0, 1);
+    ui.xformTriggers[0] = 0;      AddParam("xformI", &ui.xformTriggers[0], 0, 7);
+    ui.xformTriggers[1] = 3;      AddParam("xformII", &ui.xformTriggers[1], 0, 7);
+    ui.xformTriggers[2] = 6;      AddParam("xformIII", &ui.xformTriggers[2], 0 ,7);
+    ui.mixOut    = 0;             AddParam("mix", &ui.mixOut, 0, NUM_WORDS-1);
+    ui.freqsEdo  = 0;
     // --- //
     this->selectedVoice = 0;
-    this->numXforms = 8;
     for(int i=0;i<NUM_WORDS;i++) {
-      oscs[i] = new Saw(1);
       analogTriggers[i] = new Trigger((FP_UNITY*3)/5);
       voiceIndex[i] = 0;
+      outputKeys[i] = -1;
+      outputVoices[i] = -1;
     }
+    audioSeq = 0;
+    uiSeq = 0;
+    // nothing shows as cut until audio has built a chord
+    chordVoices = NUM_VOICES;
+    pool.SetEnvelope(5, 80);
     cvMetro.SetFreq(1000);
-    UpdateInternals();
+    ui.UpdateTables();
+    plain = ui;
+    cur = ui;
+    modsMoved = false;
+    toAudio.Write(ui);
+  }
+
+  void SyncParams() {
+    toUI.Read(ui, uiSeq);
   }
 
   void UpdateInternals() {
-    this->invEdo = FP_UNITY/this->edo;
-    for(int i=0;i<this->edo;i++) {
-      freqs[i] = noteToFreq(i);
-    }
-    for(int i=0;i<NUM_WORDS;i++) {
-      recalculateOutputs(i);
-    }
+    ui.UpdateTables();
+    toAudio.Write(ui);
   }
 
-  ~Harnomia() {
-    for(int i=0;i<NUM_WORDS;i++) {
-      delete oscs[i];
-    }
+  // only edo feeds the tables, everything else just needs publishing
+  void ParamsChanged(uint32_t changed) {
+    if(changed & edoParam) ui.UpdateTables();
+    toAudio.Write(ui);
   }
 
-  int wrapVal(int x, int max) {
-    while(x<0) x+=max;
-    while(x>=max) x-=max;
-    return x;
+  void AUDIO_FUNC(ParamsModulated)(uint32_t changed) {
+    modsMoved = true;
   }
 
-  int getColor() {
-    return inverted ? harmonic-color : color;
+  void AUDIO_FUNC(ApplyMods)() {
+    cur.edo = params[PARAM_EDO].Apply(plain.edo);
+    cur.tones = params[PARAM_TONES].Apply(plain.tones);
+    cur.harmonic = params[PARAM_HARMONIC].Apply(plain.harmonic);
+    cur.color = params[PARAM_COLOR].Apply(plain.color);
+    cur.root = params[PARAM_ROOT].Apply(plain.root);
+    cur.inverted = params[PARAM_INVERTED].Apply(plain.inverted);
+    for(int i=0;i<NUM_WORDS;i++) cur.xformTriggers[i] = params[PARAM_XFORM + i].Apply(plain.xformTriggers[i]);
+    cur.mixOut = params[PARAM_MIX].Apply(plain.mixOut);
+    cur.UpdateTables();
   }
 
-  fp_signed noteToFreq(int note) {
-    return (fp_signed)(pow(2.0, ((float)note)/((float)edo))*261.63*4);
+  ~Harnomia() {
+    for(int i=0;i<NUM_WORDS;i++) {
+      delete analogTriggers[i];
+    }
   }
 
   void UpdateDisplay() {
@@ -327,15 +1035,18 @@ public:
     int xoffset = radius+6;
     int yoffset = radius+3;
 
-    sprintf(buffer, "   %d / %d", tones, edo);
+    // a chord cut short by the voice budget shows how many of it sound
+    int heard = chordVoices;
+    if(heard < ui.tones) sprintf(buffer, "%d(%d) / %d", ui.tones, heard, ui.edo);
+    else sprintf(buffer, "   %d / %d", ui.tones, ui.edo);
     hw.display->drawStr(64, 0, buffer);
 
-    sprintf(buffer, "%2d   %2d", color, harmonic);
+    sprintf(buffer, "%2d   %2d", ui.color, ui.harmonic);
     hw.display->drawStr(78, 20, buffer);
     hw.display->drawDisc(98, 27, 4);
 
     for(int i=0;i<3;i++) {
-      sprintf(buffer, "%c", xforms[xformTriggers[i]]);
+      sprintf(buffer, "%c", HARNOMIA_XFORMS[ui.xformTriggers[i]]);
       hw.display->drawStr(
         64 + i*64/3 + 64/6,
         38,
@@ -343,19 +1054,19 @@ public:
       );
     }
 
-    sprintf(buffer, "%d", root);
+    sprintf(buffer, "%d", ui.root);
     hw.display->drawStr(xoffset-3, yoffset-6, buffer);
 
-    for(int i=0;i<edo;i++) {
-      fp_signed xCoef = SIN_LUT[(FP_MUL(SIN_LEN,i*invEdo)+(SIN_LEN/4))%1024];
-      fp_signed yCoef = SIN_LUT[FP_MUL(SIN_LEN,i*invEdo)];
-      if(i==root) {
+    for(int i=0;i<ui.edo;i++) {
+      fp_signed xCoef = SIN_LUT[(FP_MUL(SIN_LEN,i*ui.invEdo)+(SIN_LEN/4))%1024];
+      fp_signed yCoef = SIN_LUT[FP_MUL(SIN_LEN,i*ui.invEdo)];
+      if(i==ui.root) {
           hw.display->drawDisc(
           xoffset+FP_MUL(xCoef, radius),
           yoffset+FP_MUL(yCoef, radius),
           3
         );
-      } else if(i==root || i==(root+getColor())%edo || i==(root+harmonic)%edo) {
+      } else if(i==ui.root || i==(ui.root+ui.getColor())%ui.edo || i==(ui.root+ui.harmonic)%ui.edo) {
         hw.display->drawCircle(
           xoffset+FP_MUL(xCoef, radius),
           yoffset+FP_MUL(yCoef, radius),
@@ -372,78 +1083,60 @@ public:
     }
   }
 
-  void Transform(char xform) {
-    switch(xform) {
-      case '<':
-        inverted = inverted ? 0 : 1;
-        root -= getColor();
-        break;
-      case '>':
-        root += getColor();
-        inverted = inverted ? 0 : 1;
-        break;
-      case 'v':
-        root -= 1;
-        break;
-      case '^':
-        root += 1;
-        break;
-      case '-':
-        color -= 1;
-        break;
-      case '+':
-        color += 1;
-        break;
-      case 'o':
-        root = 0;
-        color = 4;
-        break;
-      case '?':
-        Transform(xforms[rand()%(numXforms-2)]);
-        break;
-    }
-    edo       = max(wrapVal(edo, 99), 2);
-    tones     = max(wrapVal(tones, edo), 1);
-    root      = wrapVal(root, edo);
-    harmonic  = max(wrapVal(harmonic, edo), 2);
-    color     = max(wrapVal(color, harmonic), 1);
-  }
-
-  void recalculateOutputs(int i) {
-    int index = i + voiceIndex[i];
-    int octave = index/tones;
-    int tone = (root + getInterval(index - octave*tones));
-    while(tone>=edo) tone-=edo;
-    hw.voctOut[i]->SetCVFP(invEdo*tone+octave*FP_UNITY);
-    oscs[i]->SetFreq((freqs[tone]<<octave)>>(i+2));
+  void AUDIO_FUNC(recalculateOutputs)(int i) {
+    int key = cur.indexToKey(i + voiceIndex[i]);
+    int octave = key/cur.edo;
+    int tone = key - octave*cur.edo;
+    hw.voctOut[i]->SetCVFP(cur.invEdo*tone+octave*FP_UNITY);
+    // keep each output's voice apart from the chord voices of the same pitch
+    outputKeys[i] = ((i+1)<<12) + key;
   }
 
-  void processAudioOutputs() {
-    for(int i=0;i<3;i++) {
-      hw.cvOut[i]->SetAudioFP(this->oscs[i]->Process());
+  // the outputs' voices first, then as many chord tones as there are
+  // voices left, so nothing is stolen within the one update
+  void AUDIO_FUNC(recalculateChord)() {
+    pool.BeginUpdate();
+    int outputs = 0;
+    for(int i=0;i<NUM_WORDS;i++) {
+      if(outputKeys[i] < 0) continue;
+      outputVoices[i] = pool.NoteOn(outputKeys[i], cur.keyToFreq(outputKeys[i]&0xFFF)>>i);
+      outputs++;
     }
+    int chord = min(cur.tones, NUM_VOICES - outputs);
+    for(int i=0;i<chord;i++) {
+      int key = cur.indexToKey(i);
+      pool.NoteOn(key, cur.keyToFreq(key));
+    }
+    pool.EndUpdate();
+    pool.mixGain = FP_UNITY/max(1, outputs + chord);
+    chordVoices = chord;
   }
 
-  int getInterval(int index) {
-    return harmonic*(index>>1) + (index&0x1 ? getColor() : 0);
-  }
-
-  fp_signed getFreq(fp_signed index) {
-    int octave = index/tones;
-    return freqs[getInterval(index - octave*tones) % edo]<<octave;
+  void AUDIO_FUNC(processAudioOutputs)() {
+    fp_signed mix = pool.Process();
+    for(int i=0;i<NUM_WORDS;i++) {
+      hw.cvOut[i]->SetAudioFP(i == cur.mixOut ? mix : pool.VoiceOut(outputVoices[i], outputKeys[i]));
+    }
   }
 
-  fp_signed getVoct(fp_signed index) {
-    int octave = index/tones;
-    return invEdo*(getInterval(index - octave*tones) % edo)<<octave;
+  void AUDIO_FUNC(ProcessControl)() {
+    if(toAudio.Read(plain, audioSeq) || modsMoved) {
+      modsMoved = false;
+      ApplyMods();
+      for(int i=0;i<NUM_WORDS;i++) {
+        recalculateOutputs(i);
+      }
+    }
   }
 
   int outputToRecalculate = 0;
-  void Process() {
+  void AUDIO_FUNC(Process)() {
+    bool transformed = false;
     for(int i=0;i<NUM_WORDS;i++) {
       hw.trigIn[i]->Update();
       if(hw.trigIn[i]->RisingEdge()) {
-        Transform(xforms[this->xformTriggers[i]]);
+        plain.Transform(HARNOMIA_XFORMS[cur.xformTriggers[i]]);
+        transformed = true;
       }
       if(analogTriggers[i]->Process(hw.analogIn[i])) {
         switch(i) {
@@ -451,17 +1144,24 @@ public:
             if(++selectedVoice>=NUM_WORDS) selectedVoice = 0;
             break;
           case 1:
-            if(++voiceIndex[selectedVoice]>tones) voiceIndex[selectedVoice] = 0;
+            if(++voiceIndex[selectedVoice]>cur.tones) voiceIndex[selectedVoice] = 0;
             break;
           case 2:
-            if(--voiceIndex[selectedVoice]<0) voiceIndex[selectedVoice] = tones;
+            if(--voiceIndex[selectedVoice]<0) voiceIndex[selectedVoice] = cur.tones;
             break;
         }
       }
     }
+    if(transformed) {
+      ApplyMods();
+      toUI.Write(plain);
+    }
     if(cvMetro.Process()) {
       recalculateOutputs(outputToRecalculate);
-      if(++outputToRecalculate > NUM_WORDS-1) outputToRecalculate = 0;
+      if(++outputToRecalculate > NUM_WORDS-1) {
+        outputToRecalculate = 0;
+        recalculateChord();
+      }
     }
     processAudioOutputs();
   }
@@ -470,26 +1170,40 @@ public:
 class LFO : public App {
 public:
   Tri* oscs[3];
+  Sine* sines[3];
+  enum { PARAM_RATE, PARAM_COEF, PARAM_SHAPE };
   int rate;
   int coef;
+  int shape;
+  int sine;
   int maxRate;
   int maxCoef;
   LFO() {
-    for(int i=0;i<3;i++) oscs[i] = new Tri(1);
+    for(int i=0;i<3;i++) {
+      oscs[i] = new Tri(1);
+      sines[i] = new Sine(1);
+    }
     rate = 30;  AddParam("rate", &rate, 0, 127);
     coef = 30;  AddParam("coef", &coef, 0, 127);
+    shape = 0;  AddParam("sine", &shape, 0, 1);
+    sine = shape;
     maxRate = FP_UNITY*5;
     maxCoef = FP_UNITY*5;
   }
   ~LFO() {
-    for(int i=0;i<3;i++) delete oscs[i];
+    for(int i=0;i<3;i++) {
+      delete oscs[i];
+      delete sines[i];
+    }
   }
   void UpdateInternals() {
-    int delta = FP_MUL(SAMPLEDELTA, (maxRate*rate)>>7);
+    int delta = FP_MUL_SAT(SAMPLEDELTA, (maxRate*params[PARAM_RATE].Modulated())>>7);
     for(int i=0;i<3;i++) {
-      oscs[i]->phasor->delta = delta;
-      delta = FP_MUL(delta, (maxCoef*coef)>>7);
+      oscs[i]->phasor.delta = delta;
+      sines[i]->phasor.delta = delta;
+      delta = FP_MUL_SAT(delta, (maxCoef*params[PARAM_COEF].Modulated())>>7);
     }
+    sine = params[PARAM_SHAPE].Modulated();
   }
   void UpdateDisplay() {
     char buffer[128];
@@ -497,9 +1211,9 @@ public:
     sprintf(buffer, " %1.3f * ( %1.3f ^ N )", FP2FLOAT((maxRate*rate)>>7), FP2FLOAT((maxCoef*coef)>>7));
     hw.display->drawStr(0, 0, buffer);
   }
-  void Process() {
+  void AUDIO_FUNC(Process)() {
     for(int i=0;i<3;i++) {
-      hw.cvOut[i]->SetAudioFP(this->oscs[i]->Process());
+      hw.cvOut[i]->SetAudioFP(sine ? this->sines[i]->Process() : this->oscs[i]->Process());
     }
   }
 };
@@ -625,28 +1339,247 @@ public:
   }
   void UpdateDisplay() {
     char buffer[64];
-    hw.display->setFont(u8g2_font_threepix_tr);
-    for(int i=0;i<min((64/6),params.size());i++) {
-      sprintf(buffer, "%s %d", params[i].GetName(), params[i].Get());
-      hw.display->drawStr(0, i*6, buffer);
+    hw.display->setFont(u8g2_font_threepix_tr);
+    for(int i=0;i<min((64/6),params.size());i++) {
+      sprintf(buffer, "%s %d", params[i].GetName(), params[i].Get());
+      hw.display->drawStr(0, i*6, buffer);
+    }
+    //sprintf(buffer, "%s %d", "voctOutCycles", int(fp_t<int,0>(voctNegVoltage*hw.voctOut[0]->res)*voctNegCoef));
+    //hw.display->drawStr(0,48, buffer);
+  }
+  void AUDIO_FUNC(Process)() {
+    for(int i=0;i<NUM_WORDS;i++) {
+      hw.voctOut[i]->SetCycles(int(fp_t<int,0>(voctNegVoltage*hw.voctOut[i]->res)*voctNegCoef));
+
+      fp_t<int32_t,14> temp = (fp_t<int32_t,14>(voctPosVoltage)+voctOffset).wmul<14>(voctPosCoef);
+      hw.voctOut[i]->SetCyclesOffset(int(temp.wmul<0>(fp_t<int32_t,0>(hw.voctOut[i]->res))));
+
+      hw.cvOut[i]->SetCycles(int(fp_t<int,0>(cvNegVoltage*hw.cvOut[i]->res)*cvNegCoef));
+      hw.cvOut[i]->SetCyclesOffset(int(fp_t<int,0>(cvPosVoltage*hw.cvOut[i]->res)*cvPosCoef));
+    }
+
+  }
+};
+
+class Calibrator : public App {
+public:
+  typedef enum { PATCH_VOCT, PATCH_CV, SAVED } Stage;
+  Stage stage;
+  int samplesToAverage;
+  Calibrator() {
+    stage = PATCH_VOCT;
+    samplesToAverage = 64;
+  }
+
+  fp_signed Measure(int i) {
+    sleep_ms(20);
+    int32_t acc = 0;
+    for(int j=0;j<samplesToAverage;j++) {
+      sleep_ms(1);
+      acc += hw.analogIn[i];
+    }
+    return acc/samplesToAverage;
+  }
+
+  // the rails give known voltages: the main pin pulls down to -negMax and
+  // the offset pin up to +posMax, so sweep one then the other
+  void CalibrateInput(int i) {
+    AnalogOut* out = hw.voctOut[i];
+    fp_signed readings[CAL_POINTS];
+    int32_t volts[CAL_POINTS];
+    for(int k=0;k<CAL_POINTS;k++) {
+      double v = -out->negMax + ((out->negMax + out->posMax)*k)/(CAL_POINTS-1);
+      if(v < 0) out->SetBoth((uint16_t)((-v/out->negMax)*out->res), 0);
+      else out->SetBoth(0, (uint16_t)((v/out->posMax)*out->res));
+      readings[k] = Measure(i);
+      volts[k] = FLOAT2FP(v);
+    }
+    hw.calibration.inputs[i].Fit(0, CAL_INPUT_SHIFT, readings, volts, CAL_POINTS);
+  }
+
+  void CalibrateOutput(int i, AnalogOut* out, CalTable* table) {
+    fp_signed volts[CAL_POINTS];
+    int32_t levels[CAL_POINTS];
+    for(int k=0;k<CAL_POINTS;k++) {
+      uint16_t level = (out->res*k)/(CAL_POINTS-1);
+      out->SetBoth(0, level);
+      volts[k] = hw.calibration.inputs[i].Lookup(Measure(i));
+      levels[k] = level<<CAL_LEVEL_BITS;
+    }
+    table->Fit(0, CAL_OUTPUT_SHIFT, volts, levels, CAL_POINTS);
+  }
+
+  void UpdateDisplay() {
+    hw.display->setFont(u8g2_font_missingplanet_tf);
+    bool pressed = false;
+    for(int i=0;i<NUM_WORDS;i++) pressed |= hw.control[i]->encButtonPressed();
+    switch(stage) {
+      case PATCH_VOCT:
+        hw.display->drawStr(0, 0, "patch V/OCT -> CV IN");
+        hw.display->drawStr(0, 16, "then press");
+        if(pressed) {
+          hw.display->drawStr(0, 32, "measuring...");
+          hw.display->sendBuffer();
+          for(int i=0;i<NUM_WORDS;i++) {
+            CalibrateInput(i);
+            CalibrateOutput(i, hw.voctOut[i], &hw.calibration.voct[i]);
+          }
+          stage = PATCH_CV;
+        }
+        break;
+      case PATCH_CV:
+        hw.display->drawStr(0, 0, "patch CV -> CV IN");
+        hw.display->drawStr(0, 16, "then press");
+        if(pressed) {
+          hw.display->drawStr(0, 32, "measuring...");
+          hw.display->sendBuffer();
+          for(int i=0;i<NUM_WORDS;i++) {
+            CalibrateOutput(i, hw.cvOut[i], &hw.calibration.cv[i]);
+          }
+          hw.SaveCalibration();
+          stage = SAVED;
+        }
+        break;
+      case SAVED:
+        hw.display->drawStr(0, 0, "calibration saved");
+        break;
+    }
+  }
+};
+
+// picks the noise shaping per word and shows what the output RC filter
+// model says each mode is worth at the chosen cutoff. Each step of the
+// model is a handful of soft double operations, so a frame only runs a
+// slice and the estimates come in over a few seconds
+#define DITHER_STEPS_PER_FRAME 2048
+class DitherMeter : public App {
+public:
+  int modes[NUM_WORDS];
+  int cutoff;
+  int lastCutoff;
+  DitherEstimate estimates[NUM_DITHER_MODES];
+  DitherMeter() {
+    for(int i=0;i<NUM_WORDS;i++) modes[i] = DITHER_OFF;
+    cutoff = 1000;
+    lastCutoff = -1;
+    AddParam("dith1", &modes[0], 0, NUM_DITHER_MODES-1);
+    AddParam("dith2", &modes[1], 0, NUM_DITHER_MODES-1);
+    AddParam("dith3", &modes[2], 0, NUM_DITHER_MODES-1);
+    AddParam("rcHz", &cutoff, 50, 5000, 50);
+  }
+  void UpdateInternals() {
+    for(int i=0;i<NUM_WORDS;i++) {
+      DitherMode mode = (DitherMode)params[i].Modulated();
+      hw.voctOut[i]->SetDither(mode);
+      hw.cvOut[i]->SetDither(mode);
+    }
+    // the cutoff describes the board's filter, so it's the knob's value and
+    // modulation doesn't restart the estimates
+    if(cutoff != lastCutoff) {
+      for(int m=0;m<NUM_DITHER_MODES;m++) estimates[m].Start((DitherMode)m, hw.cvOut[0]->res, cutoff, SAMPLERATE);
+      lastCutoff = cutoff;
+    }
+  }
+  void UpdateDisplay() {
+    // a slice of one unfinished estimate a frame, so the UI keeps moving
+    // while they come in
+    for(int m=0;m<NUM_DITHER_MODES;m++) {
+      if(estimates[m].Done()) continue;
+      estimates[m].Step(DITHER_STEPS_PER_FRAME);
+      break;
+    }
+    char buffer[64];
+    const char* names[NUM_DITHER_MODES] = {"off", "1st", "2nd"};
+    hw.display->setFont(u8g2_font_missingplanet_tf);
+    sprintf(buffer, "rc %dHz", lastCutoff);
+    hw.display->drawStr(0, 0, buffer);
+    for(int m=0;m<NUM_DITHER_MODES;m++) {
+      if(estimates[m].Done()) sprintf(buffer, "%s %2.2f bits", names[m], estimates[m].Bits());
+      else sprintf(buffer, "%s %d%%", names[m], (100*estimates[m].t)/DITHER_LEVELS);
+      hw.display->drawStr(0, 12*(m+1), buffer);
     }
-    //sprintf(buffer, "%s %d", "voctOutCycles", int(fp_t<int,0>(voctNegVoltage*hw.voctOut[0]->res)*voctNegCoef));
-    //hw.display->drawStr(0,48, buffer);
+    for(int i=0;i<NUM_WORDS;i++) hw.display->drawStr((128*i)/3, 48, names[modes[i]]);
   }
-  void Process() {
-    for(int i=0;i<NUM_WORDS;i++) {
-      hw.voctOut[i]->SetCycles(int(fp_t<int,0>(voctNegVoltage*hw.voctOut[i]->res)*voctNegCoef));
-
-      // - this works!! - //
-      fp_t<int64_t,14> temp = (fp_t<int64_t,14>(voctPosVoltage)+voctOffset)*voctPosCoef;
-      temp = temp*fp_t<int64_t,14>(hw.voctOut[i]->res);
-      hw.voctOut[i]->SetCyclesOffset(int(temp));
-      // ---- //
+};
 
-      hw.cvOut[i]->SetCycles(int(fp_t<int,0>(cvNegVoltage*hw.cvOut[i]->res)*cvNegCoef));
-      hw.cvOut[i]->SetCyclesOffset(int(fp_t<int,0>(cvPosVoltage*hw.cvOut[i]->res)*cvPosCoef));
+// Times the packed kernels in swar.h against plain Q14 on this board, so
+// they only go into the audio path where they come out ahead. A * marks the
+// kernels that win.
+class SwarMeter : public App {
+public:
+  uint32_t swarNs[NUM_SWAR_KERNELS];
+  uint32_t scalarNs[NUM_SWAR_KERNELS];
+  int frames;
+  SwarMeter() {
+    for(int k=0;k<NUM_SWAR_KERNELS;k++) swarNs[k] = scalarNs[k] = 0;
+    frames = 0;
+  }
+  void UpdateDisplay() {
+    // audio interrupts the runs, which the best-of takes care of
+    if(frames++ % 32 == 0) SwarBenchmark(swarNs, scalarNs, 16);
+    char buffer[64];
+    const char* names[NUM_SWAR_KERNELS] = {"mix", "gain", "clip", "1pole"};
+    hw.display->setFont(u8g2_font_missingplanet_tf);
+    hw.display->drawStr(0, 0, "ns/smp swar/q14");
+    for(int k=0;k<NUM_SWAR_KERNELS;k++) {
+      sprintf(buffer, "%s %u/%u %s", names[k], (unsigned)swarNs[k], (unsigned)scalarNs[k], swarNs[k] < scalarNs[k] ? "*" : "");
+      hw.display->drawStr(0, 12*(k+1), buffer);
     }
+  }
+};
 
+// Cycles per sample for a table oscillator on the CPU and on the
+// interpolator, taking turns between three oscillators the way the audio
+// path does (step) and running one for a whole block (block). It runs from
+// the main loop, so it borrows INTERP1 and leaves INTERP0 to audio.
+#define INTERP_BENCH_SAMPLES 768
+class InterpMeter : public App {
+public:
+  enum { SOFT_STEP, INTERP_STEP, SOFT_BLOCK, INTERP_BLOCK, NUM_INTERP_RUNS };
+  double cycles[NUM_INTERP_RUNS];
+  int frames;
+  InterpMeter() {
+    for(int k=0;k<NUM_INTERP_RUNS;k++) cycles[k] = 0;
+    frames = 0;
+  }
+  void Measure(int reps) {
+    static fp_signed out[INTERP_BENCH_SAMPLES];
+    uint32_t phases[3] = {0, 0, 0};
+    uint32_t deltas[3] = {RATEDELTA(SAMPLERATE)*110, RATEDELTA(SAMPLERATE)*220, RATEDELTA(SAMPLERATE)*330};
+    InterpInit(interp1, SIN_BITS);
+    for(int k=0;k<NUM_INTERP_RUNS;k++) {
+      uint32_t best = 0xFFFFFFFF;
+      for(int r=0;r<reps;r++) {
+        uint32_t start = time_us_32();
+        switch(k) {
+          case SOFT_STEP:
+            for(int i=0;i<INTERP_BENCH_SAMPLES;i+=3) {
+              for(int j=0;j<3;j++) out[i+j] = softLutStep(phases[j], deltas[j], SIN_LUT, SIN_BITS);
+            }
+            break;
+          case INTERP_STEP:
+            for(int i=0;i<INTERP_BENCH_SAMPLES;i+=3) {
+              for(int j=0;j<3;j++) out[i+j] = interpLutStep(interp1, phases[j], deltas[j], SIN_LUT);
+            }
+            break;
+          case SOFT_BLOCK: softLutBlock(0, deltas[0], SIN_LUT, SIN_BITS, out, INTERP_BENCH_SAMPLES); break;
+          case INTERP_BLOCK: interpLutBlock(interp1, 0, deltas[0], SIN_LUT, out, INTERP_BENCH_SAMPLES); break;
+        }
+        best = min(best, time_us_32() - start);
+      }
+      cycles[k] = (best*(clock_get_hz(clk_sys)/1000000.0))/INTERP_BENCH_SAMPLES;
+    }
+  }
+  void UpdateDisplay() {
+    // audio interrupts the runs, which the best-of takes care of
+    if(frames++ % 32 == 0) Measure(16);
+    char buffer[64];
+    hw.display->setFont(u8g2_font_missingplanet_tf);
+    hw.display->drawStr(0, 0, "cycles/smp cpu/interp");
+    sprintf(buffer, "step %2.1f/%2.1f", cycles[SOFT_STEP], cycles[INTERP_STEP]);
+    hw.display->drawStr(0, 12, buffer);
+    sprintf(buffer, "block %2.1f/%2.1f", cycles[SOFT_BLOCK], cycles[INTERP_BLOCK]);
+    hw.display->drawStr(0, 24, buffer);
   }
 };
 
@@ -665,14 +1598,14 @@ public:
     sprintf(buffer, "%d  %d  %d", lastVals[0], lastVals[1], lastVals[2]);
     hw.display->drawStr(0, 0, buffer);
   }
-  void Process() {
+  void AUDIO_FUNC(Process)() {
     for(int i=0;i<NUM_WORDS;i++) {
       bool curVal = hw.analogIn[i]>(FP_UNITY>>1)+(FP_UNITY/5);
       hw.trigIn[i]->Update();
       if(hw.trigIn[i]->RisingEdge()) {
         switch(i) {
           case 0:
-            kick.env->Reset();
+            kick.env.Reset();
             break;
           case 1:
             snare.env->Reset();
@@ -719,36 +1652,47 @@ public:
       bool IsComplete() {
         return (decayPhase > real_t(1)) && (attackPhase > real_t(1));
       }
-      out_t Process() {
+      out_t AUDIO_FUNC(Process)() {
         out_t out = out_t(0);
         if(attackPhase <= real_t(1)) {
           out = out_t(attackPhase);
-          auto scaledDelta = real_t(attackDelta) * fp_t<int32_t,8>(deltaScale);
+          auto scaledDelta = real_t(attackDelta).sat_mul(fp_t<int32_t,8>(deltaScale));
           attackPhase += real_t(scaledDelta);
         } else if (decayPhase <= real_t(1)) {
           out = out_t(1) - out_t(decayPhase);
-          auto scaledDelta = real_t(decayDelta) * fp_t<int32_t,8>(deltaScale);
+          auto scaledDelta = real_t(decayDelta).sat_mul(fp_t<int32_t,8>(deltaScale));
           decayPhase += real_t(scaledDelta);
         }
         return out;
       }
   };
+  // raw real_t deltas, edited as ints and handed to audio as a set
+  struct Times {
+    int attack[NUM_WORDS];
+    int decay[NUM_WORDS];
+  };
   ADEnv* adEnvs[NUM_WORDS];
   ADEnv* clockEnvs[NUM_WORDS];
   bool clockTriggered[3];
+  Times times;
+  Seqlock<Times> toAudio;
+  uint32_t audioSeq;
   MiniMaths() {
     for(int i=0;i<NUM_WORDS;i++) {
       adEnvs[i] = new ADEnv(0.01, 0.01);
       clockEnvs[i] = new ADEnv(0.001, 0.001);
       clockTriggered[i] = true;
+      times.attack[i] = (int32_t)(adEnvs[i]->attackDelta << int_<22>);
+      times.decay[i] = (int32_t)(adEnvs[i]->decayDelta << int_<22>);
     }
+    audioSeq = 0;
     int oneHz = (1<<22)/SAMPLERATE;
-    AddParam("ATK 1", (int*)&adEnvs[0]->attackDelta,  oneHz, oneHz*2000, oneHz);
-    AddParam("ATK 2", (int*)&adEnvs[1]->attackDelta,  oneHz, oneHz*2000, oneHz);
-    AddParam("ATK 3", (int*)&adEnvs[2]->attackDelta,  oneHz, oneHz*2000, oneHz);
-    AddParam("DCY 1", (int*)&adEnvs[0]->decayDelta,   oneHz, oneHz*2000, oneHz);
-    AddParam("DCY 2", (int*)&adEnvs[1]->decayDelta,   oneHz, oneHz*2000, oneHz);
-    AddParam("DCY 3", (int*)&adEnvs[2]->decayDelta,   oneHz, oneHz*2000, oneHz);
+    AddParam("ATK 1", &times.attack[0],  oneHz, oneHz*2000, oneHz);
+    AddParam("ATK 2", &times.attack[1],  oneHz, oneHz*2000, oneHz);
+    AddParam("ATK 3", &times.attack[2],  oneHz, oneHz*2000, oneHz);
+    AddParam("DCY 1", &times.decay[0],   oneHz, oneHz*2000, oneHz);
+    AddParam("DCY 2", &times.decay[1],   oneHz, oneHz*2000, oneHz);
+    AddParam("DCY 3", &times.decay[2],   oneHz, oneHz*2000, oneHz);
     paramIndices[0] = 3;
     paramIndices[1] = 4;
     paramIndices[2] = 5;
@@ -765,12 +1709,30 @@ public:
     for(int i=0;i<3;i++) {
       sprintf(buffer, "%1.2f %1.5f %1.5f",
         float(adEnvs[i]->deltaScale),
-        float(adEnvs[i]->attackDelta),
-        float(adEnvs[i]->decayDelta));
+        float(fpFromRaw<22>(times.attack[i])),
+        float(fpFromRaw<22>(times.decay[i])));
       hw.display->drawStr(0, i*16, buffer);
     }
   }
-  void Process() {
+  void UpdateInternals() {
+    Times next = times;
+    for(int i=0;i<NUM_WORDS;i++) {
+      next.attack[i] = params[i].Modulated();
+      next.decay[i] = params[NUM_WORDS + i].Modulated();
+    }
+    toAudio.Write(next);
+  }
+
+  void AUDIO_FUNC(ProcessControl)() {
+    Times next;
+    if(toAudio.Read(next, audioSeq)) {
+      for(int i=0;i<NUM_WORDS;i++) {
+        adEnvs[i]->attackDelta = fpFromRaw<22>(next.attack[i]);
+        adEnvs[i]->decayDelta = fpFromRaw<22>(next.decay[i]);
+      }
+    }
+  }
+  void AUDIO_FUNC(Process)() {
     for(int i=0;i<NUM_WORDS;i++) {
       hw.trigIn[i]->Update();
       auto ain = fp_t<int32_t,14>(hw.analogIn[i])>>13;
@@ -821,12 +1783,17 @@ public:
 
   void SetAttackSpeed(int speed) { attackSpeed = param_t(speed); }
   void SetDecaySpeed(int speed) { decaySpeed = param_t(speed); }
-  audio_t Process() {
+  audio_t AUDIO_FUNC(Process)() {
+    return Step(phase, state, hold, deltaConst * attackSpeed, deltaConst * decaySpeed);
+  }
+
+  // one sample of the envelope, shared with ADEnvBank
+  static audio_t AUDIO_FUNC(Step)(phase_t& phase, state_t& state, bool hold, phase_t attackDelta, phase_t decayDelta) {
     audio_t out = audio_t(0);
     switch(state) {
       case RISING:
         out = audio_t(phase);
-        phase += deltaConst * attackSpeed;
+        phase += attackDelta;
         if(phase > phase_t(1)) {
           phase = phase_t(1);
           if(!hold) {
@@ -836,7 +1803,7 @@ public:
         break;
       case FALLING:
         out = audio_t(phase);
-        phase -= deltaConst * decaySpeed;
+        phase -= decayDelta;
         if(phase <= phase_t(0)) {
           phase = 0;
           state = WAITING;
@@ -850,13 +1817,66 @@ public:
   }
 };
 
+// ADEnv for N channels as parallel arrays, with the per-sample deltas
+// worked out when the speeds are set
+template<int N>
+class ADEnvBank {
+public:
+  ADEnv defaults;
+  ADEnv::phase_t phase[N];
+  ADEnv::phase_t attackDelta[N];
+  ADEnv::phase_t decayDelta[N];
+  ADEnv::state_t state[N];
+  bool hold[N];
+  ADEnvBank() {
+    for(int i=0;i<N;i++) Reset(i);
+  }
+  void Reset(int c) {
+    phase[c] = defaults.phase;
+    state[c] = defaults.state;
+    hold[c] = defaults.hold;
+    SetAttackSpeed(c, int(defaults.attackSpeed));
+    SetDecaySpeed(c, int(defaults.decaySpeed));
+  }
+  void Start(int c) { state[c] = ADEnv::RISING; }
+  void Stop(int c) {
+    if(state[c] == ADEnv::RISING && hold[c]) state[c] = ADEnv::FALLING;
+  }
+  void SetAttackSpeed(int c, int speed) { attackDelta[c] = defaults.deltaConst * ADEnv::param_t(speed); }
+  void SetDecaySpeed(int c, int speed) { decayDelta[c] = defaults.deltaConst * ADEnv::param_t(speed); }
+  ADEnv::audio_t AUDIO_FUNC(Process)(int c) {
+    return ADEnv::Step(phase[c], state[c], hold[c], attackDelta[c], decayDelta[c]);
+  }
+};
+
 class LittleApp : public App {
 private:
   LittleApp() {}
 public:
   int wordIndex;
+  // the clock ClockEdge last read and the tick count it had then
+  int clockSource;
+  uint32_t seenTicks;
   LittleApp(int i) {
     wordIndex = i;
+    clockSource = PATCH_JACK;
+    seenTicks = 0;
+  }
+  // a rising edge on the trigger input, or a tick of the word patchBus
+  // clocks this one from. Changing clocks only catches up with the count,
+  // so it doesn't step by itself
+  bool AUDIO_FUNC(ClockEdge)() {
+    hw.trigIn[wordIndex]->Update();
+    int source = patchBus.ClockWord(wordIndex);
+    if(source == PATCH_JACK) {
+      clockSource = source;
+      return hw.trigIn[wordIndex]->RisingEdge();
+    }
+    uint32_t ticks = patchBus.ticks[source];
+    bool edge = source == clockSource && ticks != seenTicks;
+    clockSource = source;
+    seenTicks = ticks;
+    return edge;
   }
 };
 
@@ -864,20 +1884,22 @@ class LittleEnv : public LittleApp {
 public:
   typedef enum { PARAM_ATTACK, PARAM_DECAY, PARAM_MODE, PARAM_LAST } SelectedParam;
   SelectedParam selectedParam;
-  ADEnv env;
+  // every LittleEnv's envelope lives in this one bank, by word position
+  static ADEnvBank<NUM_WORDS> envs;
   int attackSpeed;
   int decaySpeed;
   typedef fp_t<int32_t, 14> audio_t;
-  audio_t voctCoef;
-  audio_t cvCoef;
   bool hold;
   LittleEnv(int wordIndex) : LittleApp(wordIndex) {
     this->selectedParam = PARAM_ATTACK;
     this->attackSpeed = 12;
     this->decaySpeed = 4;
     this->hold = true;
-    this->voctCoef = audio_t(5.0/6.49);
-    this->cvCoef = audio_t(5.0/8.72);
+    // for the mod matrix, in SelectedParam order; the word's own controls
+    // edit the values directly
+    AddParam("attack", &attackSpeed, 0, 64);
+    AddParam("decay", &decaySpeed, 0, 64);
+    envs.Reset(wordIndex);
   }
   void UpdateDisplay() {
     // handle controls
@@ -908,23 +1930,40 @@ public:
     sprintf(buffer, "H: %s %s", this->hold ? "T" : "F", selectedParam == PARAM_MODE ? "*" : "");
     hw.display->drawStr(appOffset+2, 30, buffer);
   }
-  void Process() {
-    hw.trigIn[wordIndex]->Update();
-    env.hold = hold;
-    if(hw.trigIn[wordIndex]->RisingEdge()) env.Start();
-    if(hw.trigIn[wordIndex]->FallingEdge()) env.Stop();
-    int speedScaler = hw.analogIn[wordIndex]>>(FP_BITS-8);
-    env.SetAttackSpeed((attackSpeed*attackSpeed*speedScaler)>>7);
-    env.SetDecaySpeed((decaySpeed*decaySpeed*speedScaler)>>7);
-    audio_t envVal = env.Process();
-    audio_t out = audio_t(envVal * voctCoef);
-    hw.voctOut[wordIndex]->SetCycles(0);
-    hw.voctOut[wordIndex]->SetCyclesOffset(((int)(fp_t<int,0>(hw.voctOut[wordIndex]->res)*voctCoef)) - ((int)(fp_t<int,0>(hw.voctOut[wordIndex]->res) * out)));
-    out = audio_t(envVal * cvCoef);
-    hw.cvOut[wordIndex]->SetCycles(0);
-    hw.cvOut[wordIndex]->SetCyclesOffset((int)(fp_t<int,0>(hw.cvOut[wordIndex]->res) * out));
+  void AUDIO_FUNC(ProcessControl)() {
+    envs.hold[wordIndex] = hold;
+    int speedScaler = patchBus.In(wordIndex)>>(FP_BITS-8);
+    int attack = params[PARAM_ATTACK].Modulated();
+    int decay = params[PARAM_DECAY].Modulated();
+    envs.SetAttackSpeed(wordIndex, (attack*attack*speedScaler)>>7);
+    envs.SetDecaySpeed(wordIndex, (decay*decay*speedScaler)>>7);
+  }
+  void SavePreset(PresetWriter& w) {
+    w.Put<int16_t>(attackSpeed);
+    w.Put<int16_t>(decaySpeed);
+    w.Put<uint8_t>(hold);
+  }
+  void LoadPreset(PresetReader& r) {
+    attackSpeed = r.Get<int16_t>();
+    decaySpeed = r.Get<int16_t>();
+    hold = r.Get<uint8_t>();
+  }
+  static void AUDIO_FUNC(ProcessChannel)(int c) {
+    hw.trigIn[c]->Update();
+    if(hw.trigIn[c]->RisingEdge()) envs.Start(c);
+    if(hw.trigIn[c]->FallingEdge()) envs.Stop(c);
+    audio_t envVal = envs.Process(c);
+    hw.voctOut[c]->SetVoltsFP(fpRaw((audio_t(1) - envVal) * fp_t<int32_t,0>(WORD_MAX_VOLTS)));
+    hw.cvOut[c]->SetVoltsFP(fpRaw(envVal * fp_t<int32_t,0>(WORD_MAX_VOLTS)));
+  }
+  void AUDIO_FUNC(Process)() {
+    ProcessChannel(wordIndex);
+  }
+  static void AUDIO_FUNC(ProcessBatch)(App* const* words, int n) {
+    for(int i=0;i<n;i++) ProcessChannel(static_cast<LittleEnv*>(words[i])->wordIndex);
   }
 };
+ADEnvBank<NUM_WORDS> LittleEnv::envs;
 
 class LittleSeq : public LittleApp {  
 public:
@@ -933,8 +1972,6 @@ public:
   typedef fp_t<int32_t, 20> phase_t;
   typedef fp_t<int32_t, 0> param_t;
   typedef fp_t<int32_t, 14> audio_t;
-  audio_t voctCoef;
-  audio_t cvCoef;
   audio_t steps[32];
   bool gates[32];
   int len;
@@ -943,6 +1980,7 @@ public:
   int clockPulseLength;
   int blinkTime;
   char editMode;
+  fp_signed stepVolts;
   LittleSeq(int wordIndex) : LittleApp(wordIndex) {
     len = 8;
     readIndex = 0;
@@ -951,12 +1989,32 @@ public:
     blinkTime = 0;
     selectedParam = PARAM_LENGTH;
     editMode = 'L';
-    this->voctCoef = audio_t(5.0/6.49);
-    this->cvCoef = audio_t(5.0/8.72);
     for(int i=0;i<32;i++) {
       steps[i] = audio_t(rand()%11 + 1) * audio_t(1.0/12.0);
       gates[i] = i == 0 ? true : false;
     }
+    UpdateStepVolts();
+  }
+  void UpdateStepVolts() {
+    stepVolts = fpRaw(steps[readIndex] * fp_t<int32_t,0>(WORD_MAX_VOLTS));
+  }
+  void SavePreset(PresetWriter& w) {
+    uint32_t gateBits = 0;
+    w.Put<uint8_t>(len);
+    for(int i=0;i<32;i++) {
+      w.Put<int16_t>(fpRaw(steps[i]));
+      if(gates[i]) gateBits |= 1u<<i;
+    }
+    w.Put<uint32_t>(gateBits);
+  }
+  void LoadPreset(PresetReader& r) {
+    len = max(1, min(32, (int)r.Get<uint8_t>()));
+    for(int i=0;i<32;i++) steps[i] = fpFromRaw<FP_BITS>(r.Get<int16_t>());
+    uint32_t gateBits = r.Get<uint32_t>();
+    for(int i=0;i<32;i++) gates[i] = (gateBits>>i) & 1;
+    if(readIndex >= len) readIndex = 0;
+    if(writeIndex >= len) writeIndex = 0;
+    UpdateStepVolts();
   }
   void UpdateDisplay() {
     // handle controls
@@ -1025,23 +2083,25 @@ public:
     hw.display->drawStr(appOffset + appWidth - 10, hw.display->getDisplayHeight() - 15, buffer);
     hw.display->setDrawColor(1);
   }
-  void Process() {
-    hw.trigIn[wordIndex]->Update();
-    if(hw.trigIn[wordIndex]->RisingEdge()) {
+  void AUDIO_FUNC(ProcessControl)() {
+    if(patchBus.In(wordIndex) > ((1<<FP_BITS)*3)/4) {
+      readIndex = 0;
+    }
+    // picks up edits from the UI as well as the reset
+    UpdateStepVolts();
+  }
+  void AUDIO_FUNC(Process)() {
+    if(ClockEdge()) {
       readIndex = readIndex + 1;
       if(readIndex >= len) {
         readIndex = 0;
       }
       if(gates[readIndex]) clockPulseLength = SAMPLERATE>>9;
-    }
-    if(hw.analogIn[wordIndex] > ((1<<FP_BITS)*3)/4) {
-      readIndex = 0;
+      UpdateStepVolts();
     }
     hw.voctOut[wordIndex]->SetCycles(0);
     hw.voctOut[wordIndex]->SetCyclesOffset(clockPulseLength-- > 0 && clockPulseLength < SAMPLERATE>>10 ? hw.voctOut[wordIndex]->res : 0);
-    audio_t out = audio_t(steps[readIndex] * cvCoef);
-    hw.cvOut[wordIndex]->SetCycles(0);
-    hw.cvOut[wordIndex]->SetCyclesOffset((int)(fp_t<int,0>(hw.cvOut[wordIndex]->res) * out));
+    hw.cvOut[wordIndex]->SetVoltsFP(stepVolts);
   }
 };
 
@@ -1061,6 +2121,19 @@ public:
     maxVal = fp_t<int32_t, 10>(5);
     minVal = fp_t<int32_t, 10>(-5);
   }
+  void SavePreset(PresetWriter& w) {
+    w.Put<uint8_t>(divs);
+    w.Put<uint8_t>(stepSize);
+    w.Put<int32_t>(fpRaw(maxVal));
+    w.Put<int32_t>(fpRaw(minVal));
+  }
+  void LoadPreset(PresetReader& r) {
+    divs = max(2, min(100, (int)r.Get<uint8_t>()));
+    stepSize = max(1, min(divs-1, (int)r.Get<uint8_t>()));
+    maxVal = fp_t<int32_t, 10>(fpFromRaw<FP_BITS>(r.Get<int32_t>()));
+    minVal = fp_t<int32_t, 10>(fpFromRaw<FP_BITS>(r.Get<int32_t>()));
+    step = 0;
+  }
   void UpdateDisplay() {
     // handle controls
     if(hw.control[wordIndex]->encButtonPressed()) selectedParam = (SelectedParam)(((int)selectedParam + 1) % PARAM_LAST);
@@ -1104,15 +2177,16 @@ public:
       if(i==step) hw.display->drawCircle(appOffset+7, y, 3);
     }
   }
-  void Process() {
-    hw.trigIn[wordIndex]->Update();
-    if(hw.trigIn[wordIndex]->RisingEdge()) {
+  void AUDIO_FUNC(Process)() {
+    if(ClockEdge()) {
       step = (step + stepSize) % divs;
       fp_t<int32_t, 10> val = fp_t<int32_t, 10>( ((maxVal - minVal) * fp_t<int32_t, 0>(step)) / fp_t<int32_t, 0>(divs-1) );
       val = fp_t<int32_t, 10>((val + minVal) * fp_t<int32_t, 10>(0.2));
       hw.cvOut[wordIndex]->SetAudioFP((fp_signed)(val*fp_t<int,0>(FP_UNITY)));
     }
-    if(hw.analogIn[wordIndex] > ((1<<FP_BITS)*3)/4) {
+  }
+  void AUDIO_FUNC(ProcessControl)() {
+    if(patchBus.In(wordIndex) > ((1<<FP_BITS)*3)/4) {
       step = 0;
       fp_t<int32_t, 10> val = fp_t<int32_t, 10>( ((maxVal - minVal) * fp_t<int32_t, 0>(step)) / fp_t<int32_t, 0>(divs-1) );
       val = fp_t<int32_t, 10>((val + minVal) * fp_t<int32_t, 10>(0.2));
@@ -1123,88 +2197,91 @@ public:
 
 class LittleQuant : public LittleApp {
 public:
-  Saw* saw;
-  typedef fp_t<int32_t, 20> phase_t;
-  typedef fp_t<int32_t, 14> audio_t;
-  typedef fp_t<int32_t, 8> voct_t;
-  std::vector<int> scale;
-  std::vector<int> scaleFreqs;
-  int degree;
-  int octave;
-  int divs;
-  int lastDegree;
-  int lastOctave;
-  int hitCount;
-  voct_t dist;
-  LittleQuant(int wordIndex) : LittleApp(wordIndex) {
-    saw = new Saw(220);
-    scale.push_back(0);
-    scale.push_back(2);
-    scale.push_back(3);
-    scale.push_back(5);
-    scale.push_back(7);
-    scale.push_back(8);
-    scale.push_back(10);
-    for(int i=0;i<scale.size();i++) scaleFreqs[i] = (int)(pow(2.0, (float)scale[i])*440.0);
-    degree = 0;
-    octave = 4;
-    divs = 14;
-    lastDegree = degree;
-    lastOctave = octave;
-    hitCount = 0;
-  }
-  ~LittleQuant() {
-    delete saw;
+  Saw saw;
+  Quantizer quant;
+  typedef enum { PARAM_EDO, PARAM_SCALE, PARAM_ROOT, PARAM_LAST } SelectedParam;
+  SelectedParam selectedParam;
+  // set from the UI, picked up by the audio side at the next control block
+  int edo;
+  int scale;
+  int root;
+  int builtEdo;
+  int builtScale;
+  int builtRoot;
+  int note;
+  fp_signed outFP;
+  LittleQuant(int wordIndex) : LittleApp(wordIndex), saw(220) {
+    selectedParam = PARAM_EDO;
+    edo = 12;       AddParam("edo", &edo, 2, MAX_EDO);
+    scale = 0;      AddParam("scale", &scale, 0, QUANT_NUM_SCALES-1);
+    root = 0;       AddParam("root", &root, 0, MAX_EDO-1);
+    Build();
+    note = quant.Quantize(0);
+    outFP = 0;
+  }
+  void AUDIO_FUNC(Build)() {
+    builtEdo = params[PARAM_EDO].Modulated();
+    builtScale = params[PARAM_SCALE].Modulated();
+    builtRoot = min(params[PARAM_ROOT].Modulated(), builtEdo-1);
+    quant.SetScale(builtEdo, builtScale, builtRoot);
+  }
+  void SavePreset(PresetWriter& w) {
+    w.Put<uint8_t>(edo);
+    w.Put<uint8_t>(scale);
+    w.Put<uint8_t>(root);
+  }
+  void LoadPreset(PresetReader& r) {
+    edo = max(2, min(MAX_EDO, (int)r.Get<uint8_t>()));
+    scale = min(QUANT_NUM_SCALES-1, (int)r.Get<uint8_t>());
+    root = min(edo-1, (int)r.Get<uint8_t>());
   }
   void UpdateDisplay() {
-    char buffer[64];
-
+    if(hw.control[wordIndex]->encButtonPressed()) selectedParam = (SelectedParam)(((int)selectedParam + 1) % PARAM_LAST);
     int encDelta = hw.control[wordIndex]->GetDelta();
     if(encDelta != 0) {
-      divs += encDelta;
-      divs = max(1, min(100, divs));
+      switch(selectedParam) {
+        case PARAM_EDO:
+          edo = max(2, min(MAX_EDO, edo + encDelta));
+          root = min(root, edo-1);
+          break;
+        case PARAM_SCALE:
+          scale = ((scale + encDelta) % QUANT_NUM_SCALES + QUANT_NUM_SCALES) % QUANT_NUM_SCALES;
+          break;
+        case PARAM_ROOT:
+          root = ((root + encDelta) % edo + edo) % edo;
+          break;
+      }
     }
 
+    char buffer[64];
     int appOffset = (wordIndex*hw.display->getDisplayWidth())/NUM_WORDS;
-    int appWidth = hw.display->getDisplayWidth()/3 - 1;
     hw.display->setFont(u8g2_font_missingplanet_tf);
-    sprintf(buffer, "D: %d", degree);
+    sprintf(buffer, "%d.%d", quant.Octave(note), quant.Degree(note));
     hw.display->drawStr(appOffset+2, 0, buffer);
-    sprintf(buffer, "O: %d", octave);
-    hw.display->drawStr(appOffset+2, 16, buffer);
-    sprintf(buffer, "/: %d", divs);
-    hw.display->drawStr(appOffset+2, 32, buffer);
+    sprintf(buffer, "E: %d %s", edo, selectedParam == PARAM_EDO ? "*" : "");
+    hw.display->drawStr(appOffset+2, 15, buffer);
+    sprintf(buffer, "%s %s", QUANT_SCALE_NAMES[scale], selectedParam == PARAM_SCALE ? "*" : "");
+    hw.display->drawStr(appOffset+2, 30, buffer);
+    sprintf(buffer, "R: %d %s", root, selectedParam == PARAM_ROOT ? "*" : "");
+    hw.display->drawStr(appOffset+2, 45, buffer);
+  }
+  void AUDIO_FUNC(ProcessControl)() {
+    int e = params[PARAM_EDO].Modulated();
+    int s = params[PARAM_SCALE].Modulated();
+    int r = min(params[PARAM_ROOT].Modulated(), e-1);
+    if(e != builtEdo || s != builtScale || r != builtRoot) Build();
   }
-  void Process() {
+  void AUDIO_FUNC(Process)() {
     hw.trigIn[wordIndex]->Update();
 
-    voct_t frac = voct_t(hw.analogIn[wordIndex]*divs)>>14;
-    int rounded = int(frac + voct_t(0.5));
-    dist = frac - voct_t(rounded);
-    if(dist < voct_t(0)) dist = -dist;
-
     if(hw.trigIn[wordIndex]->RisingEdge()) {
-      int oct = 0;
-      int deg = rounded;
-      while(deg >= 7) {
-        deg -= 7;
-        oct++;
-      }
-
-      octave = oct;
-      degree = deg;
-
-      saw->SetFreq(scaleFreqs[degree]<<(oct-2));
-
-      lastOctave = oct;
-      lastDegree = deg;
+      note = quant.Quantize(patchBus.Volts(wordIndex));
+      outFP = quant.Volts(note);
+      saw.SetFreq(voct2freq(max(0, outFP)));
     }
 
-    audio_t out = audio_t(audio_t(scale[degree]) * audio_t(1.0/12.0));
-    out = out + audio_t(max(octave-1, 0));
-
-    hw.voctOut[wordIndex]->SetCVFP((fp_signed)(out*fp_t<int,0>(FP_UNITY)));
-    hw.cvOut[wordIndex]->SetAudioFP(saw->Process());
+    hw.voctOut[wordIndex]->SetVoltsFP(outFP);
+    hw.cvOut[wordIndex]->SetAudioFP(saw.Process());
   }
 };
 
@@ -1238,16 +2315,16 @@ public:
     hw.display->setFont(u8g2_font_missingplanet_tf);
     sprintf(buffer, "KICK");
     hw.display->drawStr(appOffset+2, 0, buffer);
-    sprintf(buffer, "L:%d", 40 + (hw.analogIn[wordIndex] >> (FP_BITS - 6)));
+    sprintf(buffer, "L:%d", 40 + (patchBus.In(wordIndex) >> (FP_BITS - 6)));
     hw.display->drawStr(appOffset+2, 15, buffer);
-    sprintf(buffer, "H:%d", 150 + (hw.analogIn[wordIndex] >> (FP_BITS - 9)));
+    sprintf(buffer, "H:%d", 150 + (patchBus.In(wordIndex) >> (FP_BITS - 9)));
     hw.display->drawStr(appOffset+2, 30, buffer);
   }
-  void Process() {
+  void AUDIO_FUNC(Process)() {
     hw.trigIn[wordIndex]->Update();
     if(hw.trigIn[wordIndex]->RisingEdge()) {
-      kick.lowerFreq = 30 + (hw.analogIn[wordIndex] >> (FP_BITS - 7));
-      kick.upperFreq = 150 + (hw.analogIn[wordIndex] >> (FP_BITS - 9));
+      kick.lowerFreq = 30 + (patchBus.In(wordIndex) >> (FP_BITS - 7));
+      kick.upperFreq = 150 + (patchBus.In(wordIndex) >> (FP_BITS - 9));
       kick.Reset();
       env.Start();
     }
@@ -1263,13 +2340,18 @@ class LittleFollower : public LittleApp {
   typedef fp_t<int32_t, 14> audio_t;
   audio_t lastVal;
   audio_t gain;
-  audio_t voctCoef;
-  audio_t cvCoef;
+  // output levels for every follower, by word position
+  static SmootherBank<NUM_WORDS> levels;
   LittleFollower(int wordIndex) : LittleApp(wordIndex) {
     lastVal = 0;
     gain = audio_t(1);
-    this->voctCoef = audio_t(5.0/6.49);
-    this->cvCoef = audio_t(5.0/8.72);
+    levels.Reset(wordIndex);
+  }
+  void SavePreset(PresetWriter& w) {
+    w.Put<int32_t>(fpRaw(gain));
+  }
+  void LoadPreset(PresetReader& r) {
+    gain = max(audio_t(0), min(audio_t(20), audio_t(fpFromRaw<FP_BITS>(r.Get<int32_t>()))));
   }
   void UpdateDisplay() {
     char buffer[64];
@@ -1290,20 +2372,28 @@ class LittleFollower : public LittleApp {
     sprintf(buffer, " %1.2fx", float(gain));
     hw.display->drawStr(appOffset+2, 30, buffer);
   }
-  void Process() {
-    audio_t curVal = audio_t(abs(hw.analogIn[wordIndex]-(1<<(FP_BITS-1))));
+  // the follower runs CONTROL_BLOCK times slower, so its coefficient is
+  // that much larger for the same time constant
+  void AUDIO_FUNC(ProcessControl)() {
+    audio_t curVal = audio_t(abs(patchBus.In(wordIndex)-(1<<(FP_BITS-1))));
     audio_t diff = curVal - lastVal;
-    lastVal += diff>>10;
+    lastVal += diff>>(10-CONTROL_BLOCK_BITS);
     audio_t clippedVal = max(audio_t(0), min(audio_t(1), audio_t((lastVal>>13)*gain)));
-
-    audio_t out = audio_t(clippedVal * voctCoef);
-    hw.voctOut[wordIndex]->SetCycles(0);
-    hw.voctOut[wordIndex]->SetCyclesOffset(((int)(fp_t<int,0>(hw.voctOut[wordIndex]->res)*voctCoef)) - ((int)(fp_t<int,0>(hw.voctOut[wordIndex]->res) * out)));
-    out = audio_t(clippedVal * cvCoef);
-    hw.cvOut[wordIndex]->SetCycles(0);
-    hw.cvOut[wordIndex]->SetCyclesOffset((int)(fp_t<int,0>(hw.cvOut[wordIndex]->res) * out));
+    levels.Set(wordIndex, fpRaw(clippedVal * fp_t<int32_t,0>(WORD_MAX_VOLTS)));
+  }
+  static void AUDIO_FUNC(ProcessChannel)(int c) {
+    fp_signed volts = levels.Process(c);
+    hw.voctOut[c]->SetVoltsFP((WORD_MAX_VOLTS<<FP_BITS) - volts);
+    hw.cvOut[c]->SetVoltsFP(volts);
+  }
+  void AUDIO_FUNC(Process)() {
+    ProcessChannel(wordIndex);
+  }
+  static void AUDIO_FUNC(ProcessBatch)(App* const* words, int n) {
+    for(int i=0;i<n;i++) ProcessChannel(static_cast<LittleFollower*>(words[i])->wordIndex);
   }
 };
+SmootherBank<NUM_WORDS> LittleFollower::levels;
 
 class LFSR {
 public:
@@ -1317,7 +2407,7 @@ public:
     this->val = 0;
     this->mask = mask;
   }
-  int Process() {
+  int AUDIO_FUNC(Process)() {
     unsigned int retVal = 0;
     for(int i=0;i<bits;i++) {
       if(mask&(1<<i)) retVal = retVal^GetBit(i);
@@ -1334,11 +2424,19 @@ public:
   typedef enum { PARAM_BITS, /*PARAM_MASK, PARAM_RATE,*/ PARAM_LAST } SelectedParam;
   SelectedParam selectedParam;
   typedef fp_t<int32_t, 14> audio_t;
-  audio_t voctCoef;
-  audio_t cvCoef;
   LFSR shift;
+  // set from the UI, the register takes it with any modulation at the next
+  // control block
+  int bits;
   LittleShift(int wordIndex) : LittleApp(wordIndex) {
-
+    bits = shift.bits;
+    AddParam("bits", &bits, 1, 32);
+  }
+  void SavePreset(PresetWriter& w) {
+    w.Put<uint8_t>(bits);
+  }
+  void LoadPreset(PresetReader& r) {
+    bits = max(1, min(32, (int)r.Get<uint8_t>()));
   }
   void UpdateDisplay() {
     // handle controls
@@ -1347,7 +2445,7 @@ public:
     if(encDelta != 0) {
       switch(selectedParam) {
         case PARAM_BITS:
-          shift.bits += encDelta;
+          bits = max(1, min(32, bits + encDelta));
           break;
         /*
         case PARAM_MASK:
@@ -1385,12 +2483,14 @@ public:
     //hw.display->setFont(u8g2_font_missingplanet_tf);
     //sprintf(buffer, "A: %d %s", this->attackSpeed, selectedParam == PARAM_ATTACK ? "*" : "");
   }
-  void Process() {
-    uint32_t mask = abs((hw.analogIn[wordIndex]>>(FP_BITS-9))-(1<<8));
+  void AUDIO_FUNC(ProcessControl)() {
+    uint32_t mask = abs((patchBus.In(wordIndex)>>(FP_BITS-9))-(1<<8));
     mask = mask | (mask<<8) | (mask<<16) | (mask<<24);
     shift.mask = mask;
-    hw.trigIn[wordIndex]->Update();
-    if(hw.trigIn[wordIndex]->RisingEdge()) {
+    shift.bits = params[PARAM_BITS].Modulated();
+  }
+  void AUDIO_FUNC(Process)() {
+    if(ClockEdge()) {
       shift.Process();
       hw.voctOut[wordIndex]->SetCycles(0);
       hw.voctOut[wordIndex]->SetCyclesOffset((int)(fp_t<int,0>(hw.voctOut[wordIndex]->res) * fp_t<int,0>(shift.GetBit(0))));
@@ -1415,51 +2515,595 @@ public:
   }
 };
 
+// Follows the clock on its trigger input and puts out a multiple or
+// division of it, with swing: gates on the v/oct out, the phase of the
+// followed clock as a 0-5V ramp on the cv out, and the gates again as ticks
+// on patchBus, for any word clocked from this one in PATCH.
+#define CLOCK_PULSE (SAMPLERATE/200)
+class LittleClock : public LittleApp {
+public:
+  typedef enum { PARAM_RATIO, PARAM_SWING, PARAM_LAST } SelectedParam;
+  SelectedParam selectedParam;
+  int ratio;
+  int swing;
+  int pulse;
+  // the trigger input's tracked clock at ratio and swing
+  ClockOut clock;
+  LittleClock(int wordIndex) : LittleApp(wordIndex) {
+    selectedParam = PARAM_RATIO;
+    ratio = CLOCK_RATIO_X1 + 1;   AddParam("ratio", &ratio, 0, CLOCK_NUM_RATIOS-1);
+    swing = 50;                   AddParam("swing", &swing, 50, 75);
+    pulse = 0;
+    clock.Set(ratio, swing);
+  }
+  void SavePreset(PresetWriter& w) {
+    w.Put<uint8_t>(ratio);
+    w.Put<uint8_t>(swing);
+  }
+  void LoadPreset(PresetReader& r) {
+    ratio = min(CLOCK_NUM_RATIOS-1, (int)r.Get<uint8_t>());
+    swing = max(50, min(75, (int)r.Get<uint8_t>()));
+  }
+  void UpdateDisplay() {
+    if(hw.control[wordIndex]->encButtonPressed()) selectedParam = (SelectedParam)(((int)selectedParam + 1) % PARAM_LAST);
+    int encDelta = hw.control[wordIndex]->GetDelta();
+    if(encDelta != 0) {
+      switch(selectedParam) {
+        case PARAM_RATIO:
+          ratio = max(0, min(CLOCK_NUM_RATIOS-1, ratio + encDelta));
+          break;
+        case PARAM_SWING:
+          swing = max(50, min(75, swing + encDelta));
+          break;
+      }
+    }
+
+    char buffer[64];
+    int appOffset = (wordIndex*hw.display->getDisplayWidth())/NUM_WORDS;
+    ClockTracker& tracker = hw.clocks[wordIndex];
+    hw.display->setFont(u8g2_font_missingplanet_tf);
+    if(tracker.locked) sprintf(buffer, "%d bpm", tracker.BPM());
+    else sprintf(buffer, "--");
+    hw.display->drawStr(appOffset+2, 0, buffer);
+    sprintf(buffer, "R: %s %s", CLOCK_RATIO_NAMES[ratio], selectedParam == PARAM_RATIO ? "*" : "");
+    hw.display->drawStr(appOffset+2, 15, buffer);
+    sprintf(buffer, "S: %d %s", swing, selectedParam == PARAM_SWING ? "*" : "");
+    hw.display->drawStr(appOffset+2, 30, buffer);
+    if(tracker.locked) {
+      sprintf(buffer, "L: %dms", (int)((tracker.lockTime*1000)/SAMPLERATE));
+      hw.display->drawStr(appOffset+2, 45, buffer);
+    }
+  }
+  void AUDIO_FUNC(ProcessControl)() {
+    clock.Set(params[PARAM_RATIO].Modulated(), params[PARAM_SWING].Modulated());
+  }
+  void AUDIO_FUNC(Process)() {
+    hw.trigIn[wordIndex]->Update();
+    bool tick = clock.Process(hw.clocks[wordIndex], hw.trigIn[wordIndex]->RisingEdge());
+    if(tick) {
+      pulse = CLOCK_PULSE;
+      patchBus.ticks[wordIndex]++;
+    }
+    hw.voctOut[wordIndex]->SetVoltsFP(pulse > 0 ? WORD_MAX_VOLTS<<FP_BITS : 0);
+    if(pulse > 0) pulse--;
+    hw.cvOut[wordIndex]->SetVoltsFP((hw.clocks[wordIndex].phase >> (32-FP_BITS))*WORD_MAX_VOLTS);
+  }
+};
+
+// Euclidean rhythms: hits spread as evenly as they go over steps, turned
+// by rotate, each hit then played with a chance in percent. The pattern is
+// worked out into a bitmask whenever a parameter changes, so a clock edge
+// costs a bit test and, on a hit short of 100%, one xorshift draw. Hits
+// gate the v/oct out, the steps that don't play gate the cv out, and a
+// high cv in resets to the first step.
+#define EUCLID_MAX_STEPS 32
+class LittleEuclid : public LittleApp {
+public:
+  typedef enum { PARAM_STEPS, PARAM_HITS, PARAM_ROTATE, PARAM_CHANCE, PARAM_LAST } SelectedParam;
+  SelectedParam selectedParam;
+  // set from the UI, picked up by the audio side at the next control block
+  int steps;
+  int hits;
+  int rotate;
+  int chance;
+  int builtSteps;
+  int builtHits;
+  int builtRotate;
+  int builtChance;
+  uint32_t pattern;
+  // a draw under this plays the hit, out of 2^16
+  uint32_t threshold;
+  uint32_t rng;
+  int step;
+  int hitPulse;
+  int restPulse;
+  LittleEuclid(int wordIndex) : LittleApp(wordIndex) {
+    selectedParam = PARAM_STEPS;
+    steps = 8;      AddParam("steps", &steps, 1, EUCLID_MAX_STEPS);
+    hits = 3;       AddParam("hits", &hits, 0, EUCLID_MAX_STEPS);
+    rotate = 0;     AddParam("rotate", &rotate, 0, EUCLID_MAX_STEPS-1);
+    chance = 100;   AddParam("chance", &chance, 0, 100);
+    // Build clamps step to the pattern, so it has to be set first
+    rng = 0x9E3779B9u * (wordIndex + 1);
+    step = steps - 1;
+    hitPulse = 0;
+    restPulse = 0;
+    Build();
+  }
+  void AUDIO_FUNC(Build)() {
+    builtSteps = params[PARAM_STEPS].Modulated();
+    builtHits = params[PARAM_HITS].Modulated();
+    builtRotate = params[PARAM_ROTATE].Modulated();
+    builtChance = params[PARAM_CHANCE].Modulated();
+    // step i is a hit when i*hits wraps past a multiple of steps, which
+    // is Bjorklund's pattern up to rotation
+    uint32_t p = 0;
+    for(int i=0;i<builtSteps;i++) {
+      if((i*builtHits) % builtSteps < builtHits) p |= 1u << ((i + builtRotate) % builtSteps);
+    }
+    pattern = p;
+    threshold = (builtChance << 16)/100;
+    if(step >= builtSteps) step = builtSteps - 1;
+  }
+  void SavePreset(PresetWriter& w) {
+    w.Put<uint8_t>(steps);
+    w.Put<uint8_t>(hits);
+    w.Put<uint8_t>(rotate);
+    w.Put<uint8_t>(chance);
+  }
+  void LoadPreset(PresetReader& r) {
+    steps = max(1, min(EUCLID_MAX_STEPS, (int)r.Get<uint8_t>()));
+    hits = min(steps, (int)r.Get<uint8_t>());
+    rotate = min(steps-1, (int)r.Get<uint8_t>());
+    chance = min(100, (int)r.Get<uint8_t>());
+  }
+  void UpdateDisplay() {
+    if(hw.control[wordIndex]->encButtonPressed()) selectedParam = (SelectedParam)(((int)selectedParam + 1) % PARAM_LAST);
+    int encDelta = hw.control[wordIndex]->GetDelta();
+    if(encDelta != 0) {
+      switch(selectedParam) {
+        case PARAM_STEPS:
+          steps = max(1, min(EUCLID_MAX_STEPS, steps + encDelta));
+          hits = min(hits, steps);
+          rotate = min(rotate, steps-1);
+          break;
+        case PARAM_HITS:
+          hits = max(0, min(steps, hits + encDelta));
+          break;
+        case PARAM_ROTATE:
+          // a fast turn can take more than steps off
+          rotate = ((rotate + encDelta) % steps + steps) % steps;
+          break;
+        case PARAM_CHANCE:
+          chance = max(0, min(100, chance + encDelta));
+          break;
+      }
+    }
+
+    char buffer[64];
+    int appOffset = (wordIndex*hw.display->getDisplayWidth())/NUM_WORDS;
+    hw.display->setFont(u8g2_font_missingplanet_tf);
+    sprintf(buffer, "N: %d %s", steps, selectedParam == PARAM_STEPS ? "*" : "");
+    hw.display->drawStr(appOffset+2, 0, buffer);
+    sprintf(buffer, "K: %d %s", hits, selectedParam == PARAM_HITS ? "*" : "");
+    hw.display->drawStr(appOffset+2, 12, buffer);
+    sprintf(buffer, "R: %d %s", rotate, selectedParam == PARAM_ROTATE ? "*" : "");
+    hw.display->drawStr(appOffset+2, 24, buffer);
+    sprintf(buffer, "P: %d%% %s", chance, selectedParam == PARAM_CHANCE ? "*" : "");
+    hw.display->drawStr(appOffset+2, 36, buffer);
+    // the pattern as it's playing, a pixel column a step
+    uint32_t p = pattern;
+    int n = builtSteps;
+    for(int i=0;i<n;i++) {
+      int h = (p >> i) & 1 ? 6 : 1;
+      hw.display->drawVLine(appOffset + 2 + i, hw.display->getDisplayHeight() - 2 - h, h);
+    }
+    hw.display->drawHLine(appOffset + 2 + step, hw.display->getDisplayHeight() - 1, 1);
+  }
+  void AUDIO_FUNC(ProcessControl)() {
+    if(params[PARAM_STEPS].Modulated() != builtSteps || params[PARAM_HITS].Modulated() != builtHits
+        || params[PARAM_ROTATE].Modulated() != builtRotate || params[PARAM_CHANCE].Modulated() != builtChance) Build();
+    if(patchBus.In(wordIndex) > ((1<<FP_BITS)*3)/4) step = builtSteps - 1;
+  }
+  void AUDIO_FUNC(Process)() {
+    if(ClockEdge()) {
+      if(++step >= builtSteps) step = 0;
+      bool hit = (pattern >> step) & 1;
+      if(hit && builtChance < 100) {
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        hit = (rng >> 16) < threshold;
+      }
+      if(hit) hitPulse = CLOCK_PULSE;
+      else restPulse = CLOCK_PULSE;
+    }
+    hw.voctOut[wordIndex]->SetVoltsFP(hitPulse > 0 ? WORD_MAX_VOLTS<<FP_BITS : 0);
+    hw.cvOut[wordIndex]->SetVoltsFP(restPulse > 0 ? WORD_MAX_VOLTS<<FP_BITS : 0);
+    if(hitPulse > 0) hitPulse--;
+    if(restPulse > 0) restPulse--;
+  }
+};
+
+// Edits the mod matrix from a word slot: pick a route, then its source, the
+// word parameter it goes to and how far. Routes outlive the word, so it can
+// be swapped back out once they're set. Puts the two LFOs out as 0-5V.
+class LittleMod : public LittleApp {
+public:
+  typedef enum { PARAM_ROUTE, PARAM_SOURCE, PARAM_DEST, PARAM_DEPTH, PARAM_LAST } SelectedParam;
+  SelectedParam selectedParam;
+  int route;
+  LittleMod(int wordIndex) : LittleApp(wordIndex) {
+    selectedParam = PARAM_ROUTE;
+    route = 0;
+  }
+  int NumParams(App* host, int w) {
+    return host->Word(w) != NULL ? host->Word(w)->params.size() : 0;
+  }
+  // moves the route along the parameters of all the words in order
+  void StepDest(ModRoute& r, int delta) {
+    App* host = mods.host;
+    if(host == NULL) return;
+    int total = 0;
+    int index = 0;
+    for(int w=0;w<NUM_WORDS;w++) {
+      if(w == r.owner) index = total + min((int)r.param, max(0, NumParams(host, w) - 1));
+      total += NumParams(host, w);
+    }
+    if(total == 0) return;
+    index = ((index + delta) % total + total) % total;
+    int w = 0;
+    while(index >= NumParams(host, w)) index -= NumParams(host, w++);
+    r.owner = w;
+    r.param = index;
+  }
+  void UpdateDisplay() {
+    if(hw.control[wordIndex]->encButtonPressed()) selectedParam = (SelectedParam)(((int)selectedParam + 1) % PARAM_LAST);
+    int encDelta = hw.control[wordIndex]->GetDelta();
+    // edited as a copy and written back whole
+    ModRoute r = mods.routes[route];
+    if(encDelta != 0) {
+      switch(selectedParam) {
+        case PARAM_ROUTE:
+          route = ((route + encDelta) % MOD_ROUTES + MOD_ROUTES) % MOD_ROUTES;
+          break;
+        case PARAM_SOURCE:
+          r.source = ((r.source + encDelta) % NUM_MOD_SOURCES + NUM_MOD_SOURCES) % NUM_MOD_SOURCES;
+          break;
+        case PARAM_DEST:
+          StepDest(r, encDelta);
+          break;
+        case PARAM_DEPTH: {
+          int percent = (r.depth*100 + (FP_UNITY>>1)) >> FP_BITS;
+          percent = max(-100, min(100, percent + encDelta));
+          r.depth = (percent*FP_UNITY)/100;
+          break;
+        }
+      }
+      if(selectedParam != PARAM_ROUTE) mods.Write(route, r);
+      else r = mods.routes[route];
+    }
+
+    char buffer[64];
+    int appOffset = (wordIndex*hw.display->getDisplayWidth())/NUM_WORDS;
+    hw.display->setFont(u8g2_font_missingplanet_tf);
+    sprintf(buffer, "#%d %s", route + 1, selectedParam == PARAM_ROUTE ? "*" : "");
+    hw.display->drawStr(appOffset+2, 0, buffer);
+    sprintf(buffer, "%s %s", MOD_SOURCE_NAMES[r.source], selectedParam == PARAM_SOURCE ? "*" : "");
+    hw.display->drawStr(appOffset+2, 15, buffer);
+    App* owner = mods.host != NULL && r.owner >= 0 ? mods.host->Word(r.owner) : NULL;
+    if(owner != NULL && r.param < owner->params.size()) {
+      sprintf(buffer, "%d.%s %s", r.owner + 1, owner->params[r.param].GetName(), selectedParam == PARAM_DEST ? "*" : "");
+    } else {
+      sprintf(buffer, "- %s", selectedParam == PARAM_DEST ? "*" : "");
+    }
+    hw.display->drawStr(appOffset+2, 30, buffer);
+    sprintf(buffer, "%d%% %s", (r.depth*100 + (FP_UNITY>>1)) >> FP_BITS, selectedParam == PARAM_DEPTH ? "*" : "");
+    hw.display->drawStr(appOffset+2, 45, buffer);
+  }
+  void AUDIO_FUNC(ProcessControl)() {
+    hw.voctOut[wordIndex]->SetVoltsFP(((mods.sources[MOD_LFO1] + FP_UNITY)*WORD_MAX_VOLTS) >> 1);
+    hw.cvOut[wordIndex]->SetVoltsFP(((mods.sources[MOD_LFO2] + FP_UNITY)*WORD_MAX_VOLTS) >> 1);
+  }
+};
+
+// Sets what each word's CV input is, its own jack or another word's output
+// off the patch bus, then on a second page what clocks it, its own trigger
+// input or a CLOCK word's ticks. A word that has to read its source a
+// sample late, because they're in a loop, is marked with a z.
+class LittlePatch : public LittleApp {
+public:
+  // CV inputs first, then clocks
+  int selected;
+  LittlePatch(int wordIndex) : LittleApp(wordIndex) {
+    selected = 0;
+  }
+  void UpdateDisplay() {
+    if(hw.control[wordIndex]->encButtonPressed()) selected = (selected + 1) % (2*NUM_WORDS);
+    bool clocks = selected >= NUM_WORDS;
+    int word = selected % NUM_WORDS;
+    int encDelta = hw.control[wordIndex]->GetDelta();
+    if(encDelta != 0 && !clocks) {
+      // the jack, then the outputs
+      int n = NUM_PATCH_SOURCES + 1;
+      int source = patchBus.patch[word] - PATCH_JACK;
+      patchBus.Set(word, ((source + encDelta) % n + n) % n + PATCH_JACK);
+    }
+    if(encDelta != 0 && clocks) {
+      // the trigger input, then the words
+      int n = NUM_WORDS + 1;
+      int source = patchBus.clock[word] - PATCH_JACK;
+      patchBus.SetClock(word, ((source + encDelta) % n + n) % n + PATCH_JACK);
+    }
+
+    char buffer[64];
+    int appOffset = (wordIndex*hw.display->getDisplayWidth())/NUM_WORDS;
+    hw.display->setFont(u8g2_font_missingplanet_tf);
+    for(int i=0;i<NUM_WORDS;i++) {
+      if(clocks) {
+        int source = patchBus.clock[i];
+        sprintf(buffer, "%d@ %s %s", i + 1, source == PATCH_JACK ? "trig" : PATCH_CLOCK_NAMES[source],
+          word == i ? "*" : "");
+        hw.display->drawStr(appOffset+2, 15*i, buffer);
+        continue;
+      }
+      int source = patchBus.patch[i];
+      sprintf(buffer, "%d< %s%s %s", i + 1, source == PATCH_JACK ? "jack" : PATCH_SOURCE_NAMES[source],
+        patchBus.late[i] ? " z" : "", word == i ? "*" : "");
+      hw.display->drawStr(appOffset+2, 15*i, buffer);
+    }
+  }
+};
+
+// Bossa nova's bell, 5 hits over 16
+constexpr int BOSSA_DEFAULTS[] = {16, 5};
+
+constexpr WordEntry WORDS[] = {
+  WORD_ENTRY("SEQ", LittleSeq),
+  BATCH_WORD_ENTRY("ENV", LittleEnv),
+  WORD_ENTRY("QUANT", LittleQuant),
+  WORD_ENTRY("COUNT", LittleCount),
+  WORD_ENTRY("DRUM", LittleKick),
+  BATCH_WORD_ENTRY("FOLLOW", LittleFollower),
+  WORD_ENTRY("SHIFT", LittleShift),
+  WORD_ENTRY("CLOCK", LittleClock),
+  WORD_ENTRY("EUCLID", LittleEuclid),
+  WORD_ENTRY("MOD", LittleMod),
+  WORD_ENTRY("PATCH", LittlePatch),
+  WORD_ENTRY_DEFAULTS("BOSSA", LittleEuclid, BOSSA_DEFAULTS),
+};
+constexpr int NUM_WORD_TYPES = registrySize(WORDS);
+constexpr size_t WORD_SLOT_SIZE = registryMaxSize(WORDS);
+constexpr size_t WORD_SLOT_ALIGN = registryMaxAlign(WORDS);
+
+// an entry's own defaults go over the ones its constructor set
+template<class E> App* applyDefaults(const E& entry, App* app) {
+  for(int i=0;i<entry.numDefaults && i<app->params.size();i++) app->params[i].Set(entry.defaults[i]);
+  return app;
+}
+
 class ThreeLittleWords : public App {
 public:
-  typedef enum { SEQ, ENV, QUANT, COUNT, DRUM, FOLLOWER, SHIFT, NUM_WORDTYPES } WordType;
-  App* words[NUM_WORDS] = {NULL, NULL, NULL};
-  WordType littleWords[NUM_WORDS] = {SEQ, ENV, QUANT};
+  // each word has three slots: the word the audio side is running, the one
+  // it's fading out, and one to build the next word in. a new word is
+  // handed over through pending and picked up at the start of a control
+  // block once the last fade is done; the old one moves to outgoing and the
+  // UI tears it down after its own fade. nothing on the UI side waits on
+  // audio, and a word handed over but not picked up yet is simply replaced.
+  alignas(WORD_SLOT_ALIGN) uint8_t slots[NUM_WORDS][3][WORD_SLOT_SIZE];
+  App* volatile words[NUM_WORDS] = {NULL, NULL, NULL};
+  App* volatile pending[NUM_WORDS] = {NULL, NULL, NULL};
+  App* volatile outgoing[NUM_WORDS] = {NULL, NULL, NULL};
+  int pendingType[NUM_WORDS];
+  Crossfade fades[NUM_WORDS];
+  // until the audio side first runs the app, words are swapped in place
+  volatile bool started = false;
+  int littleWords[NUM_WORDS] = {registryFind(WORDS, "SEQ"), registryFind(WORDS, "ENV"), registryFind(WORDS, "QUANT")};
+  // audio side: the type of each running word, and the words that aren't
+  // fading grouped by type so words sharing a type run as one batch, in an
+  // order that runs each word after the one patched into it
+  int activeType[NUM_WORDS];
+  uint32_t patchVersion = 0;
+  int numGroups = 0;
+  int groupType[NUM_WORDS];
+  void (*groupProcess[NUM_WORDS])(App* const* words, int n);
+  int groupSize[NUM_WORDS];
+  App* groupWords[NUM_WORDS][NUM_WORDS];
+#ifdef AUDIO_REPORT
+  // cycles spent in each word type and how many word-samples they covered,
+  // off SysTick, for audioReport to average and clear
+  static volatile uint32_t wordCycles[NUM_WORD_TYPES];
+  static volatile uint32_t wordRuns[NUM_WORD_TYPES];
+#endif
   ThreeLittleWords() {
     for(int i=0;i<NUM_WORDS;i++) {
       loadWord(i); 
     }
+    UpdateGroups();
   }
-  void loadWord(int word) {
-    WordType type = littleWords[word];
+  ~ThreeLittleWords() {
+    for(int i=0;i<NUM_WORDS;i++) {
+      if(words[i] != NULL) words[i]->~App();
+      if(pending[i] != NULL) pending[i]->~App();
+      if(outgoing[i] != NULL) outgoing[i]->~App();
+    }
+  }
+  App* Word(int i) {
+    return words[i];
+  }
+  // the word the UI last handed over, whether or not audio has it yet
+  App* Newest(int word) {
+    App* next = pending[word];
+    return next != NULL ? next : words[word];
+  }
+  // tears down the word faded out of this position once its fade is done
+  void Collect(int word) {
+    App* old = outgoing[word];
+    if(old == NULL || fades[word].Active()) return;
+    outgoing[word] = NULL;
+    old->~App();
+  }
+  // builds a word of the position's current type in a slot nothing is
+  // using, taking back a word handed over but not picked up yet
+  App* buildWord(int word) {
+    int type = littleWords[word];
+    if(type < 0 || type >= NUM_WORD_TYPES) return NULL;
+    mods.Forget(word);
+    Collect(word);
+    uint32_t ints = save_and_disable_interrupts();
+    App* stale = pending[word];
+    pending[word] = NULL;
+    restore_interrupts(ints);
+    if(stale != NULL) stale->~App();
+    int s = 0;
+    while((App*)slots[word][s] == words[word] || (App*)slots[word][s] == outgoing[word]) s++;
+    return applyDefaults(WORDS[type], WORDS[type].make(slots[word][s], word));
+  }
+  // the check and the swap go together with interrupts off, or the audio
+  // side could start on the app in between and run the old word's groups
+  void publishWord(int word, App* newWord) {
+    int type = littleWords[word];
+    uint32_t ints = save_and_disable_interrupts();
     App* oldWord = words[word];
-    App* newWord = NULL;
-    switch(type) {
-      case SEQ: newWord = new LittleSeq(word); break;
-      case ENV: newWord = new LittleEnv(word); break;
-      case QUANT: newWord = new LittleQuant(word); break;
-      case COUNT: newWord = new LittleCount(word); break;
-      case DRUM: newWord = new LittleKick(word); break;
-      case FOLLOWER: newWord = new LittleFollower(word); break;
-      case SHIFT: newWord = new LittleShift(word); break;
-      default: return; break;
-    }
-    words[word] = newWord;
-    if(oldWord != NULL) delete oldWord;
+    if(oldWord == NULL || !started) {
+      words[word] = newWord;
+      activeType[word] = type;
+      UpdateGroups();
+      restore_interrupts(ints);
+      if(oldWord != NULL) oldWord->~App();
+      return;
+    }
+    pendingType[word] = type;
+    pending[word] = newWord;
+    restore_interrupts(ints);
+  }
+  void loadWord(int word) {
+    App* newWord = buildWord(word);
+    if(newWord != NULL) publishWord(word, newWord);
+  }
+  void SavePreset(PresetWriter& w) {
+    for(int i=0;i<NUM_WORDS;i++) {
+      w.Put<uint8_t>(littleWords[i]);
+      Newest(i)->SavePreset(w);
+    }
+  }
+  // a word of a different type is built and loaded before it's handed over,
+  // to come in under the usual crossfade
+  void LoadPreset(PresetReader& r) {
+    for(int i=0;i<NUM_WORDS;i++) {
+      int type = r.Get<uint8_t>();
+      if(!r.ok || type >= NUM_WORD_TYPES) return;
+      if(type == littleWords[i]) {
+        Newest(i)->LoadPreset(r);
+        continue;
+      }
+      littleWords[i] = type;
+      App* newWord = buildWord(i);
+      newWord->LoadPreset(r);
+      publishWord(i, newWord);
+    }
   }
   void UpdateDisplay() {
     for(int i=0;i<NUM_WORDS;i++) {
+      Collect(i);
       if(hw.control[i]->encButtonHeldFor > 20) {
         hw.control[i]->encButtonHeldFor = 0;
-        littleWords[i] = (WordType)(((int)littleWords[i]) + 1);
-        if(littleWords[i] >= NUM_WORDTYPES) littleWords[i] = (WordType)0;
+        if(++littleWords[i] >= NUM_WORD_TYPES) littleWords[i] = 0;
         loadWord(i);
       }
-      words[i]->UpdateDisplay();
+      Newest(i)->UpdateDisplay();
       if(i>0) {
         hw.display->drawVLine((i*hw.display->getDisplayWidth())/3-2, 0, hw.display->getDisplayHeight());
       }
     }
   }
-  void Process() {
-    for(int i=0;i<NUM_WORDS;i++) words[i]->Process();
+  // Words go in once their source and their clock have, preferring one of
+  // the same type as the last so batches stay whole; when only a loop is
+  // left, the first word in it goes anyway and reads its source a sample
+  // late. A batch is a run of the same type in that order. Fading words
+  // keep their place in the order but run after all the groups, in index
+  // order, so their readers are marked late by that order instead.
+  void AUDIO_FUNC(UpdateGroups)() {
+    patchVersion = patchBus.version;
+    bool placed[NUM_WORDS] = {false};
+    int last = -1;
+    numGroups = 0;
+    for(int n=0;n<NUM_WORDS;n++) {
+      int pick = -1;
+      for(int i=0;i<NUM_WORDS;i++) {
+        if(placed[i]) continue;
+        int source = patchBus.SourceWord(i);
+        if(source >= 0 && source != i && !placed[source]) continue;
+        int clock = patchBus.ClockWord(i);
+        if(clock >= 0 && clock != i && !placed[clock]) continue;
+        if(pick < 0 || (last >= 0 && activeType[i] == activeType[last] && activeType[pick] != activeType[last])) pick = i;
+      }
+      if(pick < 0) {
+        for(int i=NUM_WORDS-1;i>=0;i--) if(!placed[i]) pick = i;
+      }
+      int source = patchBus.SourceWord(pick);
+      bool late = source >= 0 && !placed[source];
+      if(source >= 0 && source != pick) {
+        if(fades[pick].Active()) late = fades[source].Active() && source > pick;
+        else late = late || fades[source].Active();
+      }
+      patchBus.late[pick] = late;
+      placed[pick] = true;
+      last = pick;
+      if(fades[pick].Active()) continue;
+      int g = numGroups - 1;
+      if(g < 0 || groupType[g] != activeType[pick]) {
+        g = numGroups++;
+        groupType[g] = activeType[pick];
+        groupProcess[g] = WORDS[activeType[pick]].process;
+        groupSize[g] = 0;
+      }
+      groupWords[g][groupSize[g]++] = words[pick];
+    }
+  }
+  void AUDIO_FUNC(ProcessControl)() {
+    started = true;
+    bool regroup = false;
+    for(int i=0;i<NUM_WORDS;i++) {
+      if(pending[i] != NULL && !fades[i].Active() && outgoing[i] == NULL) {
+        AnalogOut* outs[2] = {hw.voctOut[i], hw.cvOut[i]};
+        fades[i].Start(words[i], pending[i], outs, 2);
+        outgoing[i] = words[i];
+        words[i] = pending[i];
+        activeType[i] = pendingType[i];
+        pending[i] = NULL;
+        regroup = true;
+      }
+      if(fades[i].Active()) fades[i].ProcessControl();
+      else words[i]->ProcessControl();
+    }
+    if(regroup || patchVersion != patchBus.version) UpdateGroups();
+  }
+  // the groups go first, so a word whose fade ends here joins its group
+  // from the next sample on
+  void AUDIO_FUNC(Process)() {
+    for(int g=0;g<numGroups;g++) {
+#ifdef AUDIO_REPORT
+      uint32_t start = systick_hw->cvr;
+#endif
+      groupProcess[g](groupWords[g], groupSize[g]);
+#ifdef AUDIO_REPORT
+      // SysTick counts down through 24 bits
+      wordCycles[groupType[g]] += (start - systick_hw->cvr) & 0x00FFFFFF;
+      wordRuns[groupType[g]] += groupSize[g];
+#endif
+    }
+    for(int i=0;i<NUM_WORDS;i++) {
+      if(!fades[i].Active()) continue;
+      fades[i].Process();
+      if(!fades[i].Active()) UpdateGroups();
+    }
   }
 };
+#ifdef AUDIO_REPORT
+volatile uint32_t ThreeLittleWords::wordCycles[NUM_WORD_TYPES];
+volatile uint32_t ThreeLittleWords::wordRuns[NUM_WORD_TYPES];
+#endif
 
 
 /*
@@ -1509,7 +3153,7 @@ public:
     hw.display->drawRBox(this->selectedParam*colWidth, 57, colWidth, 3, 1);
     hw.display->drawRBox(this->playingParam*colWidth, 61, colWidth, 3, 1);
   }
-  void Process() {
+  void AUDIO_FUNC(Process)() {
     phase+=10.0/SAMPLE_RATE;
     if(phase>1.0) {
       phase=fmod(phase,1.0);
@@ -1550,7 +3194,7 @@ public:
     sprintf(buffer, "input: %f", lastVal);
     hw.display->drawStr(0, 0, buffer);
   }
-  void Process() {
+  void AUDIO_FUNC(Process)() {
     while(!adc_fifo_is_empty()) {
       lastVal = ((adc_fifo_get()*1.0)/(1<<12)) - 0.5;
     }
@@ -1609,7 +3253,7 @@ public:
     sprintf(buffer, "avg:   %4fv", (avgVal-1.666)*3.0);
     hw.display->drawStr(0, 36, buffer);
   }
-  void Process() {
+  void AUDIO_FUNC(Process)() {
     while(!adc_fifo_is_empty()) {
       lastVal = (lastVal+((adc_fifo_get()*3.333)/(1<<12)))*0.5;
     }
@@ -1652,7 +3296,7 @@ public:
     sprintf(buffer, "pulse: %dHz", 330);
     hw.display->drawStr(0, 25, buffer);
   }
-  void Process() {
+  void AUDIO_FUNC(Process)() {
     triOut->RawSet(2, FP_MUL(tri->Process(), 127) + 127);
     triOut->SetOffsetVoltage(1, OUTPUT_VMAX/2);
     sawOut->RawSet(6, FP_MUL(saw->Process(), 127) + 127);
@@ -1705,10 +3349,23 @@ public:
       lastSampleTriggered = samples;
     }
   }
-  void Process() {
+  void AUDIO_FUNC(Process)() {
     samples++;
   }
 };
 */
 
+constexpr AppEntry APPS[] = {
+  APP_ENTRY("3LW", ThreeLittleWords),
+  APP_ENTRY("HARNOMIA", Harnomia),
+  APP_ENTRY("DRUMS", Drums),
+  APP_ENTRY("OUTCAL", OutputCalibrator),
+  APP_ENTRY("CALIBRATE", Calibrator),
+  APP_ENTRY("DITHER", DitherMeter),
+  APP_ENTRY("SWAR", SwarMeter),
+  APP_ENTRY("INTERP", InterpMeter),
+  APP_ENTRY("PITCH", NoteDetector),
+};
+constexpr int NUM_APPS = registrySize(APPS);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,111 @@
+#ifndef CALIBRATION_H
+#define CALIBRATION_H
+
+#include <stddef.h>
+#include "hardware/flash.h"
+#include "fpmath.h"
+#include "constants.h"
+#include "utils.h"
+#include "dither.h"
+
+#define CAL_POINTS 9
+#define CAL_LEVEL_BITS DITHER_BITS
+#define CAL_INPUT_SHIFT (FP_BITS-3)
+#define CAL_OUTPUT_SHIFT FP_BITS
+#define CALIBRATION_MAGIC 0x43574C33
+#define CALIBRATION_VERSION 1
+#define CALIBRATION_FLASH_OFFSET (PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE)
+
+// Piecewise linear map over CAL_POINTS breakpoints spaced 2^shift apart from
+// x0. Slopes are stored alongside the points, so a loaded table is used as is.
+// Inputs map an ADC reading to volts (FP), outputs map volts (FP) to PWM
+// counts on the offset pin, scaled up by CAL_LEVEL_BITS.
+class CalTable {
+public:
+  fp_signed x0;
+  int32_t shift;
+  int32_t y[CAL_POINTS];
+  int32_t slope[CAL_POINTS-1];
+
+  void SetLinear(fp_signed x0, int shift, double y0, double dydx) {
+    this->x0 = x0;
+    this->shift = shift;
+    for(int i=0;i<CAL_POINTS;i++) y[i] = (int32_t)(y0 + dydx*FP2FLOAT(i<<shift));
+    UpdateSlopes();
+  }
+
+  // resample measured (x, y) pairs, sorted by x, onto the breakpoints
+  void Fit(fp_signed x0, int shift, const fp_signed* xs, const int32_t* ys, int n) {
+    this->x0 = x0;
+    this->shift = shift;
+    for(int i=0;i<CAL_POINTS;i++) {
+      fp_signed x = x0 + (i<<shift);
+      int j = 0;
+      while(j < n-2 && xs[j+1] < x) j++;
+      double t = xs[j+1] == xs[j] ? 0.0 : (double)(x - xs[j])/(double)(xs[j+1] - xs[j]);
+      y[i] = (int32_t)(ys[j] + t*(ys[j+1] - ys[j]));
+    }
+    UpdateSlopes();
+  }
+
+  void UpdateSlopes() {
+    for(int i=0;i<CAL_POINTS-1;i++) slope[i] = y[i+1] - y[i];
+  }
+
+  int32_t AUDIO_FUNC(Lookup)(fp_signed x) {
+    int32_t d = x - x0;
+    if(d <= 0) return y[0];
+    int32_t i = d >> shift;
+    if(i >= CAL_POINTS-1) return y[CAL_POINTS-1];
+    return y[i] + (((d - (i<<shift))*slope[i]) >> shift);
+  }
+
+  // the x that looks up to y, for a rising table; one 32 bit divide, which
+  // the RP2040's divider makes cheap enough for the input tables per sample
+  fp_signed AUDIO_FUNC(Inverse)(int32_t v) {
+    if(v <= y[0]) return x0;
+    if(v >= y[CAL_POINTS-1]) return x0 + ((CAL_POINTS-1) << shift);
+    int i = 0;
+    while(i < CAL_POINTS-2 && y[i+1] <= v) i++;
+    if(slope[i] <= 0) return x0 + (i << shift);
+    return x0 + (i << shift) + ((v - y[i]) << shift)/slope[i];
+  }
+};
+
+struct CalibrationData {
+  uint32_t magic;
+  uint32_t version;
+  CalTable inputs[NUM_WORDS];
+  CalTable voct[NUM_WORDS];
+  CalTable cv[NUM_WORDS];
+  uint32_t checksum;
+};
+
+uint32_t CalibrationChecksum(const CalibrationData* data) {
+  return fnv1a(data, offsetof(CalibrationData, checksum));
+}
+
+void DefaultCalibration(CalibrationData* data, uint16_t res) {
+  data->magic = CALIBRATION_MAGIC;
+  data->version = CALIBRATION_VERSION;
+  for(int i=0;i<NUM_WORDS;i++) {
+    data->inputs[i].SetLinear(0, CAL_INPUT_SHIFT, -VIN_DEFAULT_OFFSET*FP_UNITY, VIN_DEFAULT_SCALE*FP_UNITY);
+    data->voct[i].SetLinear(0, CAL_OUTPUT_SHIFT, 0, (res<<CAL_LEVEL_BITS)/VOCT_POUT_MEASURED);
+    data->cv[i].SetLinear(0, CAL_OUTPUT_SHIFT, 0, (res<<CAL_LEVEL_BITS)/CV_POUT_MEASURED);
+  }
+  data->checksum = CalibrationChecksum(data);
+}
+
+// the stored tables are memory mapped, so loading is a single copy
+bool LoadCalibration(CalibrationData* data, uint16_t res) {
+  const CalibrationData* stored = (const CalibrationData*)(XIP_BASE + CALIBRATION_FLASH_OFFSET);
+  if(stored->magic == CALIBRATION_MAGIC && stored->version == CALIBRATION_VERSION
+      && stored->checksum == CalibrationChecksum(stored)) {
+    memcpy(data, stored, sizeof(CalibrationData));
+    return true;
+  }
+  DefaultCalibration(data, res);
+  return false;
+}
+
+#endif
@@ -0,0 +1,227 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+#include "fpmath.h"
+#include "constants.h"
+
+// intervals kept for the median
+#define CLOCK_HISTORY 5
+// longest interval that still counts as a clock, 4s or 15 BPM
+#define CLOCK_MAX_PERIOD ((uint32_t)(4*SAMPLE_RATE))
+// intervals within 1/2^this of the median count as steady
+#define CLOCK_TOLERANCE_BITS 4
+// an edge pulls the internal phase 1/2^this of the way onto itself
+#define CLOCK_PHASE_BITS 2
+// missing for this many periods and the clock is stopped
+#define CLOCK_TIMEOUT_PERIODS 2
+
+// Follows a clock on a trigger input. Edges are timestamped in samples, the
+// period comes from the median of the last few intervals, or their mean when
+// all of them agree with it so it isn't held to whole samples, and a phasor
+// runs at that period between edges. Each edge moves the phasor part way
+// onto itself rather than restarting it, so a late or early pulse shifts
+// the internal clock by a fraction of its error and a missing one doesn't
+// shift it at all. Locked once three intervals in a row agree.
+class ClockTracker {
+public:
+  uint32_t now;
+  uint32_t lastEdge;
+  uint32_t intervals[CLOCK_HISTORY];
+  int count;
+  int next;
+  bool last;
+  bool started;
+  bool locked;
+  // in samples, Q8
+  uint32_t period;
+  uint32_t phase;
+  uint32_t delta;
+  // whole periods of the phasor since it locked, and whether it wrapped
+  // on the last sample
+  uint32_t beat;
+  bool tick;
+  // samples from the first edge to lock, for the record
+  uint32_t firstEdge;
+  uint32_t lockTime;
+  ClockTracker() {
+    Reset();
+  }
+  void Reset() {
+    now = 0;
+    lastEdge = 0;
+    count = 0;
+    next = 0;
+    last = false;
+    started = false;
+    locked = false;
+    period = 0;
+    phase = 0;
+    delta = 0;
+    beat = 0;
+    tick = false;
+    firstEdge = 0;
+    lockTime = 0;
+  }
+  uint32_t Median() {
+    uint32_t sorted[CLOCK_HISTORY];
+    for(int i=0;i<count;i++) {
+      uint32_t v = intervals[i];
+      int j = i;
+      for(;j>0 && sorted[j-1] > v;j--) sorted[j] = sorted[j-1];
+      sorted[j] = v;
+    }
+    return sorted[count>>1];
+  }
+  // the latest n intervals all within tolerance of m
+  bool Steady(uint32_t m, int n) {
+    for(int i=1;i<=n;i++) {
+      uint32_t v = intervals[(next + CLOCK_HISTORY - i) % CLOCK_HISTORY];
+      if(abs((int32_t)(v - m)) > (int32_t)(m >> CLOCK_TOLERANCE_BITS)) return false;
+    }
+    return true;
+  }
+  void Edge() {
+    uint32_t interval = now - lastEdge;
+    lastEdge = now;
+    if(!started || interval > CLOCK_MAX_PERIOD) {
+      // first edge, or the first after a stop
+      started = true;
+      count = 0;
+      next = 0;
+      locked = false;
+      firstEdge = now;
+      return;
+    }
+    intervals[next] = interval;
+    next = (next + 1) % CLOCK_HISTORY;
+    if(count < CLOCK_HISTORY) count++;
+    if(count < 3) return;
+    uint32_t lastPeriod = period;
+    uint32_t m = Median();
+    if(Steady(m, count)) {
+      uint32_t sum = 0;
+      for(int i=0;i<count;i++) sum += intervals[i];
+      period = (sum << 8)/count;
+    } else {
+      period = m << 8;
+    }
+    delta = (uint32_t)((1ull << 40)/period);
+    if(!locked) {
+      if(!Steady(m, 3)) return;
+      locked = true;
+      lockTime = now - firstEdge;
+      phase = 0;
+      beat = 0;
+      tick = true;
+      return;
+    }
+    // the phasor should be at 0 now; wrapping forward past it is a beat.
+    // A new tempo puts it right on the edge, since all the phase it gained
+    // or lost at the old one is error
+    int32_t error = (int32_t)phase;
+    bool retimed = abs((int32_t)(period - lastPeriod)) > (int32_t)(lastPeriod >> CLOCK_TOLERANCE_BITS);
+    uint32_t corrected = retimed ? 0 : phase - (error >> CLOCK_PHASE_BITS);
+    if(error < 0 && (int32_t)corrected >= 0) {
+      beat++;
+      tick = true;
+    }
+    phase = corrected;
+  }
+  void AUDIO_FUNC(Process)(bool level) {
+    now++;
+    tick = false;
+    if(locked) {
+      uint32_t lastPhase = phase;
+      phase += delta;
+      if(phase < lastPhase) {
+        beat++;
+        tick = true;
+      }
+      if(now - lastEdge > CLOCK_TIMEOUT_PERIODS*(period >> 8)) {
+        locked = false;
+        started = false;
+      }
+    }
+    if(level && !last) Edge();
+    last = level;
+  }
+  int BPM() {
+    return locked ? (int)((60*256*SAMPLE_RATE)/period) : 0;
+  }
+};
+
+#define CLOCK_NUM_RATIOS 9
+const char* const CLOCK_RATIO_NAMES[CLOCK_NUM_RATIOS] = {"/8", "/4", "/3", "/2", "x1", "x2", "x3", "x4", "x8"};
+const uint8_t CLOCK_MULTS[CLOCK_NUM_RATIOS] = {1, 1, 1, 1, 1, 2, 3, 4, 8};
+const uint8_t CLOCK_DIVS[CLOCK_NUM_RATIOS]  = {8, 4, 3, 2, 1, 1, 1, 1, 1};
+#define CLOCK_RATIO_X1 4
+
+// Ticks at mult/div of a tracked clock, in phase with it: over each div of
+// its beats there are mult ticks, every other one pushed late by swing
+// (percent of a pair, 50 is straight), with the cycle doubled when swing
+// needs an even count. Tick positions are worked out one at a time as
+// they're reached. Straight x1, or a clock that isn't locked, passes the
+// input's own edges through.
+class ClockOut {
+public:
+  int ratio;
+  int swing;
+  int mult;
+  int div;
+  int k;
+  uint32_t lastBeat;
+  // spacing of ticks and position of the next, in beats Q32
+  uint64_t spacing;
+  uint64_t target;
+  ClockOut() {
+    ratio = CLOCK_RATIO_X1;
+    swing = 50;
+    Restart();
+  }
+  void Restart() {
+    mult = CLOCK_MULTS[ratio];
+    div = CLOCK_DIVS[ratio];
+    if(swing != 50 && (mult & 1)) {
+      mult *= 2;
+      div *= 2;
+    }
+    spacing = ((uint64_t)div << 32)/mult;
+    // nothing until the start of the next cycle
+    k = mult;
+    target = 0;
+    lastBeat = 0xFFFFFFFF;
+  }
+  void Set(int ratio, int swing) {
+    if(ratio == this->ratio && swing == this->swing) return;
+    this->ratio = ratio;
+    this->swing = swing;
+    Restart();
+  }
+  uint64_t AUDIO_FUNC(Target)(int k) {
+    if(!(k & 1)) return k*spacing;
+    return (k-1)*spacing + (2*spacing*swing)/100;
+  }
+  bool AUDIO_FUNC(Process)(const ClockTracker& clock, bool edge) {
+    if(!clock.locked || (ratio == CLOCK_RATIO_X1 && swing == 50)) {
+      lastBeat = 0xFFFFFFFF;
+      return edge;
+    }
+    uint32_t cycleBeat = clock.beat % div;
+    if(clock.beat != lastBeat) {
+      lastBeat = clock.beat;
+      if(cycleBeat == 0) {
+        k = 0;
+        target = 0;
+      }
+    }
+    uint64_t position = ((uint64_t)cycleBeat << 32) | clock.phase;
+    if(k < mult && position >= target) {
+      target = Target(++k);
+      return true;
+    }
+    return false;
+  }
+};
+
+#endif
@@ -2,8 +2,29 @@
 #define CONSTANTS_H
 
 #define CPU_SPEED 125000000.0
-#define TIMER_INTERVAL ((int)(1000000.0/40000.0))
+// engine rate, picked per build with -DSAMPLE_RATE_HZ=...; the audio timer
+// counts whole microseconds, so SAMPLE_RATE is the rate actually achieved
+// (rates dividing 1MHz such as 8k, 40k, 50k or 100k are exact)
+#ifndef SAMPLE_RATE_HZ
+#define SAMPLE_RATE_HZ 40000
+#endif
+#define TIMER_INTERVAL ((int)(1000000.0/SAMPLE_RATE_HZ + 0.5))
 #define SAMPLE_RATE (1000000.0/TIMER_INTERVAL)
+// apps get a ProcessControl() call once every CONTROL_BLOCK samples
+#define CONTROL_BLOCK_BITS 5
+#define CONTROL_BLOCK (1<<CONTROL_BLOCK_BITS)
+// overlap when switching words or apps
+#define CROSSFADE_MS 20
+// audio path functions and tables are placed in SRAM one by one with these,
+// so a cache miss after the display code has run can't stall a sample;
+// -DAUDIO_CODE_IN_FLASH leaves them in flash for comparison
+#ifdef AUDIO_CODE_IN_FLASH
+#define AUDIO_FUNC(f) f
+#define AUDIO_DATA
+#else
+#define AUDIO_FUNC(f) __not_in_flash_func(f)
+#define AUDIO_DATA __not_in_flash("audio_data")
+#endif
 #define LFO_OUT_PIN 0
 #define OFFSET_OUT_PIN 1
 
@@ -28,4 +49,12 @@
 
 #define CV_IN_2_V(x) ((SIG*3)-VIN_5V0)
 
+// uncalibrated fallbacks, as measured on the prototype
+#define VOCT_POUT_MEASURED  6.49
+#define CV_POUT_MEASURED    8.72
+#define VIN_DEFAULT_SCALE   10.68
+#define VIN_DEFAULT_OFFSET  5.29
+
+#define WORD_MAX_VOLTS 5
+
 #endif
\ No newline at end of file
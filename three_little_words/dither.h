@@ -0,0 +1,123 @@
+#ifndef DITHER_H
+#define DITHER_H
+
+#include <math.h>
+#include <stdint.h>
+#include "constants.h"
+
+#define DITHER_BITS 8
+
+typedef enum { DITHER_OFF, DITHER_FIRST, DITHER_SECOND, NUM_DITHER_MODES } DitherMode;
+
+// Error feedback quantiser for the PWM levels. The fraction of a count that
+// rounding drops is carried into the next samples (first or second order),
+// which moves the error up in frequency where the output RC filter takes it out.
+class NoiseShaper {
+public:
+  DitherMode mode;
+  int32_t err1;
+  int32_t err2;
+  NoiseShaper() {
+    this->mode = DITHER_OFF;
+    this->err1 = 0;
+    this->err2 = 0;
+  }
+  void SetMode(DitherMode mode) {
+    this->mode = mode;
+    this->err1 = 0;
+    this->err2 = 0;
+  }
+  // fine is in PWM counts << DITHER_BITS
+  uint16_t AUDIO_FUNC(Process)(int32_t fine, int32_t maxLevel) {
+    int32_t target = fine;
+    if(mode == DITHER_FIRST) target += err1;
+    else if(mode == DITHER_SECOND) target += 2*err1 - err2;
+    int32_t level = (target + (1<<(DITHER_BITS-1))) >> DITHER_BITS;
+    if(level < 0) level = 0;
+    if(level > maxLevel) level = maxLevel;
+    if(mode != DITHER_OFF) {
+      // only clamping at the rails can push this past half a count; don't let it wind up
+      const int32_t lim = 1<<(DITHER_BITS-1);
+      int32_t e = target - (level<<DITHER_BITS);
+      err2 = err1;
+      err1 = e > lim ? lim : e < -lim ? -lim : e;
+    }
+    return level;
+  }
+};
+
+// Model of the output stage that also builds on the host: the PWM level is
+// averaged over each sample and the RC filter is a one-pole at the sample
+// rate. Holds a spread of sub-count levels, lets the filter settle and
+// gives the effective bits of the filtered output over maxLevel counts.
+// It's a few hundred thousand soft float steps on the M0+, so Step runs a
+// slice of them at a time and the UI spreads the work over frames.
+#define DITHER_LEVELS 64
+#define DITHER_MEASURE 2048
+class DitherEstimate {
+public:
+  DitherMode mode;
+  int32_t maxLevel;
+  double a;
+  int settle;
+  NoiseShaper shaper;
+  // the level being held, and the filter sample within it
+  int t;
+  int k;
+  int32_t fine;
+  double exact;
+  double y;
+  double sumSq;
+  long n;
+  DitherEstimate() {
+    t = DITHER_LEVELS;
+    n = 0;
+  }
+  void Start(DitherMode mode, int32_t maxLevel, double cutoffHz, double sampleRate) {
+    this->mode = mode;
+    this->maxLevel = maxLevel;
+    shaper.SetMode(mode);
+    a = 1.0 - exp(-2.0*M_PI*cutoffHz/sampleRate);
+    settle = (int)(8.0/a);
+    fine = 0;
+    exact = 0.0;
+    y = 0.0;
+    sumSq = 0.0;
+    n = 0;
+    t = -1;
+    k = settle + DITHER_MEASURE;
+  }
+  bool Done() { return t >= DITHER_LEVELS; }
+  // runs up to steps filter samples, returns Done()
+  bool Step(long steps) {
+    while(!Done() && steps-- > 0) {
+      if(k >= settle + DITHER_MEASURE) {
+        if(++t >= DITHER_LEVELS) break;
+        // an irrational step so the fractions don't repeat
+        double target = maxLevel*(0.1 + 0.8*fmod(t*0.6180339887, 1.0));
+        fine = (int32_t)(target*(1<<DITHER_BITS));
+        exact = ((double)fine)/(1<<DITHER_BITS);
+        y = exact;
+        k = 0;
+      }
+      y += a*(shaper.Process(fine, maxLevel) - y);
+      if(k >= settle) {
+        sumSq += (y - exact)*(y - exact);
+        n++;
+      }
+      k++;
+    }
+    return Done();
+  }
+  double Bits() { return n > 0 ? log2(maxLevel/(sqrt(sumSq/n)*sqrt(12.0))) : 0.0; }
+};
+
+// the whole estimate in one go, for the host
+double DitherEffectiveBits(DitherMode mode, int32_t maxLevel, double cutoffHz, double sampleRate) {
+  DitherEstimate estimate;
+  estimate.Start(mode, maxLevel, cutoffHz, sampleRate);
+  while(!estimate.Step(1L << 20));
+  return estimate.Bits();
+}
+
+#endif
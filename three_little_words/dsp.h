@@ -4,55 +4,137 @@
 #include "fpmath.h"
 #include "constants.h"
 #include "fp.hpp"
+#include "interp.h"
 
 #define SAMPLERATE  ((int)SAMPLE_RATE)
 #define SAMPLEDELTA (0xFFFFFFFF/SAMPLERATE)
+#define RATEDELTA(rate) (0xFFFFFFFF/(rate))
+#define CONTROLRATE (SAMPLERATE/CONTROL_BLOCK)
 
 using namespace fp;
 using namespace fp::constants;
 
-class Phasor {
+// raw FP_BITS value of an fp_t, for the FP_* macros and AnalogOut
+template<class F> fp_signed fpRaw(const F &v) {
+  return (fp_signed)(fp_t<int32_t,FP_BITS>(v) << int_<FP_BITS>);
+}
+
+// and back, from a raw value with E fractional bits
+template<int E> fp_t<int32_t,E> fpFromRaw(int32_t raw) {
+  return fp_t<int32_t,E>(fp_t<int32_t,0>(raw) >> int_<E>);
+}
+
+// The rate based primitives take the rate they're processed at as a template
+// argument so the per-sample deltas fold to constants. The plain names are
+// the engine rate, fixed per build by SAMPLE_RATE_HZ; anything run at the
+// control rate (the mod matrix lanes) uses the ...At<RATE> form.
+template<int RATE>
+class PhasorAt {
 public:
+  static const uint32_t DELTA = RATEDELTA(RATE);
   uint32_t phase;
   uint32_t delta;
-  Phasor() {
+  PhasorAt() {
     this->phase = 0;
-    this->delta = SAMPLEDELTA;
+    this->delta = DELTA;
   }
-  Phasor(fp_signed freq) {
+  PhasorAt(fp_signed freq) {
     this->phase = 0;
     this->SetFreq(freq);
   }
-  void SetFreq(fp_signed freq) {
-    this->delta = SAMPLEDELTA*freq;
+  void AUDIO_FUNC(SetFreq)(fp_signed freq) {
+    this->delta = DELTA*freq;
   }
   void SetFreqFractional(fp_signed fracFreq) {
-    this->delta = FP_MUL(SAMPLEDELTA, fracFreq);
+    this->delta = FP_MUL(DELTA, fracFreq);
   }
   void SetDuration(uint32_t ms) {
-    this->delta = (SAMPLEDELTA*1000)/ms;
+    this->delta = (DELTA*1000)/ms;
   }
-  uint32_t Process() {
+  uint32_t AUDIO_FUNC(Process)() {
     uint32_t out = phase;
     phase += delta;
     return out;
   }
 };
+typedef PhasorAt<SAMPLERATE> Phasor;
 
-class Metronome : public Phasor {
+template<int RATE>
+class MetronomeAt : public PhasorAt<RATE> {
 public:
-  Metronome(uint32_t ms) : Phasor() {
-    phase = 0xFFFFFFFF;
-    SetDuration(ms);
+  MetronomeAt(uint32_t ms) : PhasorAt<RATE>() {
+    this->phase = 0xFFFFFFFF;
+    this->SetDuration(ms);
   }
-  Metronome() : Phasor() {
-    phase = 0xFFFFFFFF;
-    SetFreq(0);
+  MetronomeAt() : PhasorAt<RATE>() {
+    this->phase = 0xFFFFFFFF;
+    this->SetFreq(0);
   }
-  uint32_t Process() {
-    uint32_t lastPhase = phase;
-    phase += delta;
-    return phase < lastPhase ? FP_UNITY : 0;
+  uint32_t AUDIO_FUNC(Process)() {
+    uint32_t lastPhase = this->phase;
+    this->phase += this->delta;
+    return this->phase < lastPhase ? FP_UNITY : 0;
+  }
+};
+typedef MetronomeAt<SAMPLERATE> Metronome;
+
+// ramps from the last value to one set at control rate over the next
+// CONTROL_BLOCK samples, so the audio lane doesn't see the steps
+class Smoother {
+public:
+  fp_signed value;
+  fp_signed target;
+  fp_signed step;
+  int count;
+  Smoother() {
+    this->value = 0;
+    this->target = 0;
+    this->step = 0;
+    this->count = 0;
+  }
+  void Set(fp_signed target) {
+    this->target = target;
+    this->step = (target - value) >> CONTROL_BLOCK_BITS;
+    this->count = CONTROL_BLOCK;
+  }
+  fp_signed AUDIO_FUNC(Process)() {
+    if(count > 0) {
+      value += step;
+      if(--count == 0) value = target;
+    }
+    return value;
+  }
+};
+
+// Smoother for N channels kept as parallel arrays, so a loop over the
+// channels walks each field contiguously
+template<int N>
+class SmootherBank {
+public:
+  fp_signed value[N];
+  fp_signed target[N];
+  fp_signed step[N];
+  int count[N];
+  SmootherBank() {
+    for(int i=0;i<N;i++) Reset(i);
+  }
+  void Reset(int c) {
+    value[c] = 0;
+    target[c] = 0;
+    step[c] = 0;
+    count[c] = 0;
+  }
+  void Set(int c, fp_signed target) {
+    this->target[c] = target;
+    this->step[c] = (target - value[c]) >> CONTROL_BLOCK_BITS;
+    this->count[c] = CONTROL_BLOCK;
+  }
+  fp_signed AUDIO_FUNC(Process)(int c) {
+    if(count[c] > 0) {
+      value[c] += step[c];
+      if(--count[c] == 0) value[c] = target[c];
+    }
+    return value[c];
   }
 };
 
@@ -71,7 +153,7 @@ public:
     triggered = false;
     return out;
   }
-  fp_signed Process(fp_signed curVal) {
+  fp_signed AUDIO_FUNC(Process)(fp_signed curVal) {
     fp_signed out = 0;
     if(curVal > threshold && lastVal < threshold) {
       out = FP_UNITY;
@@ -82,18 +164,19 @@ public:
   }
 };
 
-class Line {
+template<int RATE>
+class LineAt {
 public:
   uint32_t phase;
   uint32_t delta;
 
-  Line(uint32_t ms) {
-    delta = SAMPLEDELTA*1000/ms;
+  LineAt(uint32_t ms) {
+    delta = RATEDELTA(RATE)*1000/ms;
   }
 
   void Reset() { phase = 0; }
 
-  fp_signed Process() {
+  fp_signed AUDIO_FUNC(Process)() {
     if(phase < (0xFFFFFFFF-delta)) {
       uint32_t out = phase >> (32-FP_BITS);
       phase += delta;
@@ -103,48 +186,64 @@ public:
     }
   }
 };
+typedef LineAt<SAMPLERATE> Line;
 
-class Osc {
+template<int RATE>
+class OscAt {
 public:
-  Phasor* phasor;
-  Osc(fp_signed freq) {
-    phasor = new Phasor(freq);
-  }
-  ~Osc() {
-    delete phasor;
-  }
-  void SetFreq(fp_signed freq) {
-    phasor->SetFreq(freq);
+  PhasorAt<RATE> phasor;
+  OscAt(fp_signed freq) : phasor(freq) {}
+  virtual ~OscAt() {}
+  void AUDIO_FUNC(SetFreq)(fp_signed freq) {
+    phasor.SetFreq(freq);
   }
   void SetDuration(uint32_t ms) {
-    phasor->SetDuration(ms);
+    phasor.SetDuration(ms);
   }
   virtual fp_signed Process() = 0;
 };
+typedef OscAt<SAMPLERATE> Osc;
 
-class Saw : public Osc {
+template<int RATE>
+class SawAt : public OscAt<RATE> {
 public:
-  Saw(fp_signed freq) : Osc(freq) {}
-  fp_signed Process() {
-    return (phasor->Process() >> (31-FP_BITS)) - FP_UNITY;
+  SawAt(fp_signed freq) : OscAt<RATE>(freq) {}
+  fp_signed AUDIO_FUNC(Process)() {
+    return (this->phasor.Process() >> (31-FP_BITS)) - FP_UNITY;
   }
 };
+typedef SawAt<SAMPLERATE> Saw;
 
-class Pulse : public Osc {
+template<int RATE>
+class PulseAt : public OscAt<RATE> {
 public:
-  Pulse(fp_signed freq) : Osc(freq) {}
-  fp_signed Process() {
-    return phasor->Process() < (0x7FFFFFFF) ? FP_UNITY : -FP_UNITY;
+  PulseAt(fp_signed freq) : OscAt<RATE>(freq) {}
+  fp_signed AUDIO_FUNC(Process)() {
+    return this->phasor.Process() < (0x7FFFFFFF) ? FP_UNITY : -FP_UNITY;
   }
 };
+typedef PulseAt<SAMPLERATE> Pulse;
 
-class Tri : public Osc {
+template<int RATE>
+class TriAt : public OscAt<RATE> {
 public:
-  Tri(fp_signed freq) : Osc(freq) {}
-  fp_signed Process() {
-    return abs((fp_signed)((phasor->Process() >> (30-FP_BITS)) - (FP_UNITY<<1))) - FP_UNITY;
+  TriAt(fp_signed freq) : OscAt<RATE>(freq) {}
+  fp_signed AUDIO_FUNC(Process)() {
+    return abs((fp_signed)((this->phasor.Process() >> (30-FP_BITS)) - (FP_UNITY<<1))) - FP_UNITY;
   }
 };
+typedef TriAt<SAMPLERATE> Tri;
+
+// reads SIN_LUT through the interpolator, see interp.h
+template<int RATE>
+class SineAt : public OscAt<RATE> {
+public:
+  SineAt(fp_signed freq) : OscAt<RATE>(freq) {}
+  fp_signed AUDIO_FUNC(Process)() {
+    return lutStep(this->phasor.phase, this->phasor.delta, SIN_LUT, SIN_BITS);
+  }
+};
+typedef SineAt<SAMPLERATE> Sine;
 
 class OnePoleLP {
 public:
@@ -157,7 +256,7 @@ public:
   void SetCoef(fp_signed coef) {
     this->coef = coef;
   }
-  fp_signed Process(fp_signed input) {
+  fp_signed AUDIO_FUNC(Process)(fp_signed input) {
     input = input<<11;
     lastVal = ((input*1)>>11) + ((lastVal*((1<<11)-1))>>11);
     return lastVal>>11;
@@ -167,7 +266,7 @@ public:
 class OnePoleHP : public OnePoleLP {
 public:
   OnePoleHP(fp_signed coef) : OnePoleLP(coef) {}
-  fp_signed Process(fp_signed input) {
+  fp_signed AUDIO_FUNC(Process)(fp_signed input) {
     lastVal = FP_MUL(input,coef) + FP_MUL(lastVal, FP_UNITY-coef);
     return input-lastVal;
   }
@@ -196,7 +295,7 @@ public:
     this->delay = delaySamples;
   }
 
-  fp_signed Process(fp_signed input) {
+  fp_signed AUDIO_FUNC(Process)(fp_signed input) {
     writeHead++;
     if(writeHead >= bufferLength) writeHead -= bufferLength;
     int32_t readHead = writeHead - delay;
@@ -219,7 +318,7 @@ public:
   ~Comb() {
     delete delay;
   }
-  fp_signed Process(fp_signed input) {
+  fp_signed AUDIO_FUNC(Process)(fp_signed input) {
     lastVal = delay->Process(input + FP_MUL(lastVal, feedback));
     return lastVal;
   }
@@ -239,41 +338,36 @@ public:
     delete osca;
     delete oscb;
   }
-  fp_signed Process() {
+  fp_signed AUDIO_FUNC(Process)() {
     fp_signed out = env->Process();
     for(int i=0;i<3;i++) out = FP_MUL(out,out);
     return FP_MUL(out, FP_MUL(osca->Process(), oscb->Process()));
   }
 };
 
+// held by value so a word using it can be built in place without the heap
 class Kick {
 public:
-  Tri* osc;
-  Line* env;
+  Tri osc;
+  Line env;
   int upperFreq;
   int lowerFreq;
-  Kick() {
-    osc = new Tri(400);
-    env = new Line(250);
+  Kick() : osc(400), env(250) {
     upperFreq = 400;
     lowerFreq = 70;
   }
-  ~Kick() {
-    delete osc;
-    delete env;
-  }
   void Reset() {
-    osc->phasor->phase = 0;
-    env->Reset();
+    osc.phasor.phase = 0;
+    env.Reset();
   }
-  fp_signed Process() {
-    fp_signed out = env->Process();
+  fp_signed AUDIO_FUNC(Process)() {
+    fp_signed out = env.Process();
     fp_signed lenv = out;
     for(int i=0;i<4;i++) {
       out=FP_MUL(out,out);
     }
-    osc->SetFreq(FP_MUL(upperFreq,out)+lowerFreq);
-    return FP_MUL(osc->Process(), lenv);
+    osc.SetFreq(FP_MUL(upperFreq,out)+lowerFreq);
+    return FP_MUL(osc.Process(), lenv);
   }
 };
 
@@ -289,7 +383,7 @@ public:
     delete osc;
     delete env;
   }
-  fp_signed Process() {
+  fp_signed AUDIO_FUNC(Process)() {
     fp_signed out = env->Process();
     fp_signed lenv = out;
     for(int i=0;i<2;i++) {
@@ -21,6 +21,22 @@
 #include <limits>
 #include <algorithm>
 
+#ifdef FP_CHECKED
+#ifdef ARDUINO
+#error "FP_CHECKED is a host-only build mode"
+#endif
+#include <cstdio>
+#include <cstdlib>
+#endif
+
+#if defined(__ARM_FEATURE_SAT)
+#include <arm_acle.h>
+#endif
+
+#if defined(ARDUINO_ARCH_RP2040)
+#include "pico/divider.h"
+#endif
+
 namespace fp {
 
 namespace detail {
@@ -74,7 +90,130 @@ namespace constants {
 	template<unsigned int I> constexpr auto uint_ = std::integral_constant<unsigned int, I>{};
 };
 
+namespace detail { // saturation: clamp to the range of the base type instead of wrapping
+	template<class R, class V> constexpr R sat_narrow(const V &v) {
+		if constexpr (!std::is_integral<R>::value || !std::is_integral<V>::value) {
+			return R(v);
+		} else if constexpr (std::is_signed<R>::value != std::is_signed<V>::value) {
+			return R(v);
+		} else if constexpr (sizeof(R) >= sizeof(V)) {
+			return R(v);
+		} else {
+#if defined(__ARM_FEATURE_SAT)
+			if constexpr (std::is_signed<R>::value && sizeof(V) == 4) return R(__ssat(v, 8*sizeof(R)));
+#endif
+			if(v > V(std::numeric_limits<R>::max())) return std::numeric_limits<R>::max();
+			if(v < V(std::numeric_limits<R>::lowest())) return std::numeric_limits<R>::lowest();
+			return R(v);
+		}
+	}
+
+	// constant shift that clamps instead of losing the top bits on a left shift
+	template<intmax_t V, class A> constexpr auto sat_shift(const A &a) {
+		using R = decltype(const_shift<V>(a));
+		if constexpr (V <= 0 || !std::is_integral<R>::value) {
+			return const_shift<V>(a);
+		} else if constexpr (V >= std::numeric_limits<R>::digits) {
+			return a == 0 ? R(0) : a < 0 ? std::numeric_limits<R>::lowest() : std::numeric_limits<R>::max();
+		} else {
+			R r{};
+			if(__builtin_mul_overflow(R(a), R(R(1) << V), &r)) {
+				return a < 0 ? std::numeric_limits<R>::lowest() : std::numeric_limits<R>::max();
+			}
+			return r;
+		}
+	}
+
+	// __builtin_*_overflow lowers to a flag test after the add on ARMv6-M,
+	// which has no SSAT/QADD, so this is the cheapest saturation on device.
+	struct sat_plus {
+		template<class A, class B> constexpr auto operator()(const A &a, const B &b) const {
+			using R = decltype(a + b);
+			if constexpr (!std::is_integral<R>::value) { return a + b; } else {
+				R r{};
+				if(__builtin_add_overflow(a, b, &r)) return b > 0 ? std::numeric_limits<R>::max() : std::numeric_limits<R>::lowest();
+				return r;
+			}
+		}
+	};
+	struct sat_minus {
+		template<class A, class B> constexpr auto operator()(const A &a, const B &b) const {
+			using R = decltype(a - b);
+			if constexpr (!std::is_integral<R>::value) { return a - b; } else {
+				R r{};
+				if(__builtin_sub_overflow(a, b, &r)) return b < 0 ? std::numeric_limits<R>::max() : std::numeric_limits<R>::lowest();
+				return r;
+			}
+		}
+	};
+	struct sat_multiplies {
+		template<class A, class B> constexpr auto operator()(const A &a, const B &b) const {
+			using R = decltype(a * b);
+			if constexpr (!std::is_integral<R>::value) { return a * b; } else {
+				R r{};
+				if(__builtin_mul_overflow(a, b, &r)) return (a < 0) != (b < 0) ? std::numeric_limits<R>::lowest() : std::numeric_limits<R>::max();
+				return r;
+			}
+		}
+	};
+
+	// saturating counterpart of each operator; the rest only saturate the alignment shifts
+	template<class BOP> struct sat_op                      { using type = BOP;            static constexpr const char *name = "op"; };
+	template<>          struct sat_op<std::plus      <>>   { using type = sat_plus;       static constexpr const char *name = "+";  };
+	template<>          struct sat_op<std::minus     <>>   { using type = sat_minus;      static constexpr const char *name = "-";  };
+	template<>          struct sat_op<std::multiplies<>>   { using type = sat_multiplies; static constexpr const char *name = "*";  };
+	template<>          struct sat_op<std::divides   <>>   { using type = std::divides<>; static constexpr const char *name = "/";  };
+
+	// 32x32->64 multiply. ARMv6-M only has a 32x32->32 MULS and gcc lowers a
+	// 64-bit product to __aeabi_lmul, a full 64x64 multiply, so build it from
+	// four 16x16 partial products there instead. The partial products are
+	// defined everywhere, so the host tests can check them.
+	constexpr uint64_t umul32x32_parts(uint32_t a, uint32_t b) {
+		uint32_t al = a & 0xFFFF, ah = a >> 16, bl = b & 0xFFFF, bh = b >> 16;
+		uint32_t ll = al * bl, lh = al * bh, hl = ah * bl, hh = ah * bh;
+		uint32_t mid = (ll >> 16) + (lh & 0xFFFF) + (hl & 0xFFFF);
+		return (uint64_t(hh + (lh >> 16) + (hl >> 16) + (mid >> 16)) << 32) | (mid << 16) | (ll & 0xFFFF);
+	}
+	constexpr uint64_t umul32x32(uint32_t a, uint32_t b) {
+#if defined(__ARM_ARCH_6M__)
+		return umul32x32_parts(a, b);
+#else
+		return uint64_t(a) * b;
+#endif
+	}
+
+	constexpr int64_t smul32x32(int32_t a, int32_t b) {
+		uint64_t p = umul32x32(uint32_t(a), uint32_t(b));
+		if(a < 0) p -= uint64_t(uint32_t(b)) << 32;
+		if(b < 0) p -= uint64_t(uint32_t(a)) << 32;
+		return int64_t(p);
+	}
+
+	// Division through the RP2040 SIO divider. The pico_divider routines save
+	// and restore the divider state, so they're safe from the audio ISR too.
+	constexpr int32_t sdiv32(int32_t n, int32_t d) {
+#if defined(ARDUINO_ARCH_RP2040)
+		if(!__builtin_is_constant_evaluated()) return div_s32s32(n, d);
+#endif
+		return n / d;
+	}
+	constexpr int64_t sdiv64(int64_t n, int64_t d) {
+#if defined(ARDUINO_ARCH_RP2040)
+		if(!__builtin_is_constant_evaluated()) return div_s64s64(n, d);
+#endif
+		return n / d;
+	}
+
+#ifdef FP_CHECKED
+	[[noreturn]] inline void report_overflow(const char *op, intmax_t ea, intmax_t eb, intmax_t e) {
+		std::fprintf(stderr, "fp_t overflow: fp_t<%jd> %s fp_t<%jd> -> fp_t<%jd>\n", ea, op, eb, e);
+		std::abort();
+	}
+#endif
+};
+
 template<class> struct is_fp : std::false_type {};
+template<class> struct reciprocal;
 
 template<class T, intmax_t E = 0, class BASE = decltype(detail::const_shift<E>(T{}))> struct fp_t {
 	using underlying_type = T;
@@ -91,7 +230,17 @@ template<class T, intmax_t E = 0, class BASE = decltype(detail::const_shift<E>(T
 
 	template<class B>
 	constexpr fp_t(const B &b, std::enable_if_t< is_fp<B>::value>* = 0) :
-		base(detail::const_shift<E - B::exp::value>(b.base)) {}
+		base(detail::const_shift<E - B::exp::value>(b.base)) {
+#ifdef FP_CHECKED
+		if(saturate(b).base != base) detail::report_overflow("=", B::exp::value, B::exp::value, E);
+#endif
+	}
+
+	// Conversion that clamps to the representable range instead of wrapping
+	template<class B, class = std::enable_if_t< is_fp<B>{} >>
+	static constexpr fp_t saturate(const B &b) {
+		return fp_t{ detail::sat_narrow<base_type>(detail::sat_shift<E - B::exp::value>(b.base)), false };
+	}
 	//
 
 	// Operators Implementation
@@ -128,8 +277,44 @@ template<class T, intmax_t E = 0, class BASE = decltype(detail::const_shift<E>(T
 	DECL auto& operator*=(const B &b) { return *this = *this * b; }
 	DECL auto& operator/=(const B &b) { return *this = *this / b; }
 	DECL auto& operator%=(const B &b) { return *this = *this % b; }
+
+	// Saturating variants, same result types as the operators above
+	DECL auto sat_add(const B &b) const { return sat_bin_op<emax,detail::sat_plus     >(*this, b); }
+	DECL auto sat_sub(const B &b) const { return sat_bin_op<emax,detail::sat_minus    >(*this, b); }
+	DECL auto sat_mul(const B &b) const { return sat_bin_op<esum,detail::sat_multiplies>(*this, b); }
 #undef DECL
 
+	// Widening multiply: the full 64-bit product of 32-bit bases, rescaled to
+	// exponent R and rounded down like FP_MUL. Wider bases use operator*.
+	template<intmax_t R, class B, class = std::enable_if_t< is_fp<B>{} >>
+	constexpr fp_t<T,R> wmul(const B &b) const {
+		using result_base = typename fp_t<T,R>::base_type;
+		constexpr intmax_t S = E + B::exp::value - R;
+		if constexpr (sizeof(base_type) <= 4 && sizeof(typename B::base_type) <= 4) {
+			int64_t p = detail::smul32x32(base, b.base);
+			if constexpr (S == 32) return fp_t<T,R>(result_base(uint64_t(p) >> 32), false);
+			else if constexpr (S >= 0) return fp_t<T,R>(result_base(p >> S), false);
+			else return fp_t<T,R>(result_base(p * (int64_t(1) << -S)), false);
+		} else {
+			return fp_t<T,R>(*this * b);
+		}
+	}
+
+	// Division rescaled to exponent R, truncated like operator/. Stays in 32
+	// bits when no precision has to be shifted in, otherwise widens the
+	// numerator; both go through the SIO divider on device.
+	template<intmax_t R, class B, class = std::enable_if_t< is_fp<B>{} >>
+	constexpr fp_t<T,R> wdiv(const B &b) const {
+		using result_base = typename fp_t<T,R>::base_type;
+		constexpr intmax_t S = R - E + B::exp::value;
+		if constexpr (sizeof(base_type) <= 4 && sizeof(typename B::base_type) <= 4) {
+			if constexpr (S <= 0) return fp_t<T,R>(result_base(detail::const_shift<S>(detail::sdiv32(base, b.base))), false);
+			else return fp_t<T,R>(result_base(detail::sdiv64(int64_t(base) * (int64_t(1) << S), b.base)), false);
+		} else {
+			return fp_t<T,R>(*this / b);
+		}
+	}
+
 	template<class B> constexpr auto& operator<<=(const B &b) { return *this = *this << b; }
 	template<class B> constexpr auto& operator>>=(const B &b) { return *this = *this >> b; }
 
@@ -154,6 +339,7 @@ template<class T, intmax_t E = 0, class BASE = decltype(detail::const_shift<E>(T
 	//
 private:
 	template<class, intmax_t, class> friend struct fp_t;
+	template<class> friend struct reciprocal;
 	friend std::numeric_limits<fp_t>;
 
 	template<intmax_t Ea, class A> static constexpr auto make(const A &a) {
@@ -178,9 +364,24 @@ private:
 	}
 	template<template<intmax_t,intmax_t> class EOP, class BOP, class A, class B>
 	static constexpr auto bin_op(const A &a, const B &b) {
-		return make<EOP<typename A::exp{}, typename B::exp{}>::e>(
+		auto r = make<EOP<typename A::exp{}, typename B::exp{}>::e>(
 			bin_op_raw<EOP,BOP, typename A::exp{}, typename B::exp{}>(a.base, b.base)
 		);
+#ifdef FP_CHECKED
+		// the saturated result only differs from the wrapped one when something overflowed
+		if(sat_bin_op<EOP,typename detail::sat_op<BOP>::type>(a, b).base != r.base) {
+			detail::report_overflow(detail::sat_op<BOP>::name, A::exp::value, B::exp::value, decltype(r)::exp::value);
+		}
+#endif
+		return r;
+	}
+	template<template<intmax_t,intmax_t> class EOP, class BOP, class A, class B>
+	static constexpr auto sat_bin_op(const A &a, const B &b) {
+		constexpr intmax_t Ea = A::exp::value, Eb = B::exp::value;
+		return make<EOP<Ea,Eb>::e>(BOP{}(
+			detail::sat_shift<EOP<Ea,Eb>::ea - Ea>(a.base),
+			detail::sat_shift<EOP<Ea,Eb>::eb - Eb>(b.base)
+		));
 	}
 	//
 
@@ -189,6 +390,77 @@ private:
 
 template<class T, intmax_t E, class BASE> struct is_fp<fp_t<T,E,BASE>> : std::true_type {};
 
+// Repeated division by the same value: 1/d is refined once by Newton-Raphson,
+// after which divide() is a multiply plus a remainder correction, and gives
+// exactly the result of wdiv(). Only for divisors with 32-bit bases.
+template<class D> struct reciprocal {
+	static_assert(sizeof(typename D::base_type) <= 4, "reciprocal needs a 32-bit divisor");
+
+	uint32_t ud;  // |d|
+	uint32_t x;   // floor(2^(31+l)/ud), with l the bit length of ud
+	int l;
+	bool neg;
+
+	constexpr explicit reciprocal(const D &d) : ud(0), x(0), l(0), neg(d.base < 0) {
+		ud = neg ? uint32_t(0) - uint32_t(d.base) : uint32_t(d.base);
+		if(ud == 0) return;
+		l = 32 - __builtin_clz(ud);
+		uint32_t dn = ud << (32 - l);  // d normalised to [0.5,1) in Q32
+		// x ~ 1/dn in Q31, from the 48/17 - 32/17*d estimate
+		int64_t xi = int64_t(0x169696969ull) - int64_t(detail::umul32x32(0xF0F0F0F1u, dn) >> 32);
+		for(int i=0;i<3;i++) {
+			uint32_t xc = xi > 0xFFFFFFFFll ? 0xFFFFFFFFu : uint32_t(xi);
+			int64_t e = int64_t((uint64_t(1) << 63) - detail::umul32x32(dn, xc)) >> 32;  // 1 - d*x in Q31
+			xi = int64_t(xc) + ((int64_t(xc) * e) >> 31);
+		}
+		x = xi > 0xFFFFFFFFll ? 0xFFFFFFFFu : uint32_t(xi);
+		// settle on exactly floor(2^(31+l)/ud) so estimates never overshoot
+		uint64_t one = uint64_t(1) << (31 + l);
+		while(detail::umul32x32(x, ud) > one) x--;
+		while(x != 0xFFFFFFFFu && detail::umul32x32(x + 1, ud) <= one) x++;
+	}
+
+	template<intmax_t R, class A, class = std::enable_if_t< is_fp<A>{} >>
+	constexpr fp_t<typename A::underlying_type,R> divide(const A &a) const {
+		using result_type = fp_t<typename A::underlying_type,R>;
+		using result_base = typename result_type::base_type;
+		static_assert(sizeof(typename A::base_type) <= 4, "reciprocal needs a 32-bit dividend");
+		constexpr intmax_t S = R - A::exp::value + D::exp::value;
+		bool aneg = a.base < 0;
+		uint32_t ua = aneg ? uint32_t(0) - uint32_t(a.base) : uint32_t(a.base);
+		int64_t q;
+		if constexpr (S <= 0) {
+			q = int64_t(udiv(ua));
+			if(aneg != neg) q = -q;
+			q = detail::const_shift<S>(q);
+		} else {
+			q = int64_t(udiv(uint64_t(ua) << S));
+			if(aneg != neg) q = -q;
+		}
+		return result_type(result_base(q), false);
+	}
+
+private:
+	constexpr uint64_t estimate(uint64_t n) const {
+		uint32_t nh = uint32_t(n >> 32);
+		uint64_t lo = detail::umul32x32(uint32_t(n), x);
+		uint64_t mid = (nh ? detail::umul32x32(nh, x) : 0) + (lo >> 32);
+		return mid >> (l - 1);
+	}
+	// each estimate is low by at most q/2^31 + 1, so a 32-bit dividend takes one
+	// pass and a remainder step, a 64-bit one a pass more
+	constexpr uint64_t udiv(uint64_t n) const {
+		uint64_t q = 0;
+		while(n >= ud) {
+			uint64_t e = estimate(n);
+			if(e == 0) e = 1;
+			q += e;
+			n -= detail::umul32x32(uint32_t(e), ud) + (uint64_t(uint32_t(e >> 32) * ud) << 32);
+		}
+		return q;
+	}
+};
+
 template<class T, intmax_t E> static constexpr auto make_fp(const fp_t<T,E> &a) { return a; }
 template<int E = 0, class T> static constexpr fp_t<T,E> make_fp(const T &a) { return a; }
 
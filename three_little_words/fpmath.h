@@ -1,6 +1,8 @@
 #ifndef FPMATH_H
 #define FPMATH_H
 
+#include "constants.h"
+
 typedef int32_t fp_signed;
 #define FP_BITWIDTH 32
 #define FP_BITS 14
@@ -9,26 +11,71 @@ typedef int32_t fp_signed;
 #define FP_DIV(n, d) (((n)<<FP_BITS) / (d))
 #define FP2FLOAT(x) ((x) / ((double)(FP_UNITY)))
 #define FLOAT2FP(x) ((fp_signed)((x) * FP_UNITY))
+#define FP_MUL_SAT(x, y) fp_mul_sat((x), (y))
+
+fp_signed AUDIO_FUNC(fp_sat)(int64_t x) {
+  if(x > INT32_MAX) return INT32_MAX;
+  if(x < INT32_MIN) return INT32_MIN;
+  return (fp_signed)x;
+}
+
+// products of two operands under 2^15 can't overflow, so only fall back to
+// a 64-bit multiply when one of them is large
+fp_signed AUDIO_FUNC(fp_mul_sat)(fp_signed x, fp_signed y) {
+  if((((uint32_t)x + 0x8000) | ((uint32_t)y + 0x8000)) < 0x10000) return FP_MUL(x, y);
+  return fp_sat((((int64_t)x) * y) >> FP_BITS);
+}
+
+// The tables are built by the compiler and land in .data, so boot only
+// copies them instead of running a few thousand soft float sin/pow calls.
+// Series are summed well past double precision over the ranges used.
+constexpr double lutSin(double x) {
+  if(x > M_PI) x -= 2.0*M_PI;
+  double term = x;
+  double sum = x;
+  for(int n=1;n<20;n++) {
+    term *= -x*x/((2*n)*(2*n+1));
+    sum += term;
+  }
+  return sum;
+}
 
-#define SIN_LEN 1024
-fp_signed SIN_LUT[SIN_LEN];
-void INIT_SIN_LUT() {
-  for(int i=0;i<SIN_LEN;i++) {
-    SIN_LUT[i] = (fp_signed)(((double)FP_UNITY) * sin((i*M_PI*2.0)/((float)SIN_LEN)));
+// 2^x for x in [0,1]
+constexpr double lutExp2(double x) {
+  double y = x*M_LN2;
+  double term = 1.0;
+  double sum = 1.0;
+  for(int n=1;n<25;n++) {
+    term *= y/n;
+    sum += term;
   }
+  return sum;
+}
+
+#define SIN_BITS 10
+#define SIN_LEN (1<<SIN_BITS)
+struct SinTable { fp_signed v[SIN_LEN]; };
+constexpr SinTable makeSinTable() {
+  SinTable t = {};
+  for(int i=0;i<SIN_LEN;i++) t.v[i] = (fp_signed)(((double)FP_UNITY) * lutSin((i*M_PI*2.0)/SIN_LEN));
+  return t;
 }
+SinTable SIN_TABLE = makeSinTable();
+fp_signed (&SIN_LUT)[SIN_LEN] = SIN_TABLE.v;
 
 #define LUT_BITS 15
 #define LUT_UNITY (1<<LUT_BITS)
 #define TWOEXP_LEN 4096
-uint32_t TWOEXP_LUT[TWOEXP_LEN];
-void INIT_TWOEXP_LUT() {
-  for(int i=0;i<TWOEXP_LEN;i++) {
-    TWOEXP_LUT[i] = (uint32_t)(((double)LUT_UNITY) * (pow(2.0, ((float)i)/((float)TWOEXP_LEN)) - 1.0));
-  }
+struct TwoExpTable { uint32_t v[TWOEXP_LEN]; };
+constexpr TwoExpTable makeTwoExpTable() {
+  TwoExpTable t = {};
+  for(int i=0;i<TWOEXP_LEN;i++) t.v[i] = (uint32_t)(((double)LUT_UNITY) * (lutExp2(((double)i)/TWOEXP_LEN) - 1.0));
+  return t;
 }
+TwoExpTable TWOEXP_TABLE = makeTwoExpTable();
+uint32_t (&TWOEXP_LUT)[TWOEXP_LEN] = TWOEXP_TABLE.v;
 
-fp_signed twoexp(fp_signed x) {
+fp_signed AUDIO_FUNC(twoexp)(fp_signed x) {
   if(x<0) {
     return 0;
   } else if(x==0) {
@@ -40,13 +87,26 @@ fp_signed twoexp(fp_signed x) {
   }
 }
 
-fp_signed voct2freq(fp_signed x) {
+fp_signed AUDIO_FUNC(voct2freq)(fp_signed x) {
   return (33 * twoexp(x))>>LUT_BITS;
 }
 
-void INIT_FPMATH() {
-  INIT_SIN_LUT();
-  INIT_TWOEXP_LUT();
+// the other way, log2(x/LUT_UNITY) by a search of TWOEXP_LUT, with the
+// last two bits interpolated between entries
+fp_signed AUDIO_FUNC(twolog)(uint32_t x) {
+  if(x == 0) return INT32_MIN;
+  int whole = 31 - __builtin_clz(x);
+  uint32_t frac = (whole >= LUT_BITS ? x >> (whole - LUT_BITS) : x << (LUT_BITS - whole)) - LUT_UNITY;
+  int lo = 0;
+  int hi = TWOEXP_LEN;
+  while(hi - lo > 1) {
+    int mid = (lo + hi) >> 1;
+    if(TWOEXP_LUT[mid] <= frac) lo = mid;
+    else hi = mid;
+  }
+  uint32_t next = lo+1 < TWOEXP_LEN ? TWOEXP_LUT[lo+1] : LUT_UNITY;
+  int sub = ((frac - TWOEXP_LUT[lo]) << (FP_BITS-12)) / (next - TWOEXP_LUT[lo]);
+  return (whole - LUT_BITS)*FP_UNITY + (lo << (FP_BITS-12)) + sub;
 }
 
 
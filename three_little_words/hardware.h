@@ -7,7 +7,12 @@
 #include "pico/stdlib.h"
 #include "hardware/adc.h"
 #include "hardware/pwm.h"
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+#include "interp.h"
 #include "fpmath.h"
+#include "dither.h"
+#include "clock.h"
 
 #ifdef U8X8_HAVE_HW_SPI
 #include <SPI.h>
@@ -18,6 +23,8 @@
 
 #define NUM_WORDS 3
 
+#include "calibration.h"
+
 uint TOP_BTN_CCW[] = {0, 16, 21};
 uint ENC_BTN_CW[]  = {1, 17, 22};
 uint TRIG_IN[]     = {18, 19, 20};
@@ -31,14 +38,18 @@ public:
   bool state;
   bool fallingEdge;
   bool risingEdge;
+  GateTrigger() {}
   GateTrigger(uint pin) {
+    Init(pin);
+  }
+  void Init(uint pin) {
     this->pin = pin;
     this->state = false;
     this->fallingEdge = false;
     this->risingEdge = false;
     gpio_pull_up(pin);
   }
-  void Update() {
+  void AUDIO_FUNC(Update)() {
     bool newState = !gpio_get(pin);
     if(newState > state) this->risingEdge = true;
     if(newState < state) this->fallingEdge = true;
@@ -161,25 +172,79 @@ public:
   }
 };
 
+#define PWM_MAP_BITS 16
+
+// affine map from a FP_BITS signal to PWM counts, worked out once per
+// calibration so each sample write is a multiply-add; the result keeps
+// DITHER_BITS of fraction for the noise shaper to round off
+class PWMMap {
+public:
+  int32_t bias;
+  int32_t gain;
+  int32_t maxLevel;
+  PWMMap() {
+    this->bias = 0;
+    this->gain = 0;
+    this->maxLevel = 0;
+  }
+  void Set(double base, double countsPerUnit, uint16_t maxLevel) {
+    this->bias = (int32_t)(base*(1<<PWM_MAP_BITS));
+    this->gain = (int32_t)(countsPerUnit*(1<<(PWM_MAP_BITS-FP_BITS)));
+    this->maxLevel = maxLevel;
+  }
+  int32_t AUDIO_FUNC(Fine)(fp_signed v) {
+    return (bias + v*gain) >> (PWM_MAP_BITS-DITHER_BITS);
+  }
+};
+
 class AnalogOut {
 public:
   uint16_t res;
   uint offset;
+  uint slice;
+  bool pairedSlice;
   double negMax;
   double posMax;
   fp_signed negMaxFP;
   fp_signed posMaxFP;
-  fp_signed invNegMaxFP;
-  fp_signed invPosMaxFP;
+  // audio drives the offset pin around a fixed level on the main pin,
+  // CV drives the main pin against a fixed level on the offset pin
+  PWMMap audioMap;
+  PWMMap cvMap;
+  uint16_t audioMainLevel;
+  uint16_t cvOffsetLevel;
+  CalTable* table;
+  NoiseShaper shaper;
+  // while capturing, audio writes are held for a crossfade to mix
+  bool capture;
+  bool captured;
+  fp_signed capturedFP;
+  // the nominal voltage at the jack (FP), kept by the setters words use so
+  // other words can take it off the patch bus as if it came in through a CV
+  // input; raw cycle writes go through the last levels of the two pins
+  fp_signed patchVolts;
+  int32_t posCountVolts;
+  int32_t negCountVolts;
+  fp_signed audioVolts;
+  uint16_t mainLevel;
+  uint16_t offsetLevel;
+  AnalogOut() {}
   AnalogOut(int offset, int resolution = 255, double negMax = VOCT_NOUT_MAX, double posMax = VOCT_POUT_MAX) {
+    Init(offset, resolution, negMax, posMax);
+  }
+  void Init(int offset, int resolution = 255, double negMax = VOCT_NOUT_MAX, double posMax = VOCT_POUT_MAX) {
     this->offset = offset;
     this->res = resolution;
-    this->negMax = negMax;
-    this->posMax = posMax;
-    this->negMaxFP = FLOAT2FP(negMax);
-    this->posMaxFP = FLOAT2FP(posMax);
-    this->invNegMaxFP = FP_DIV(FP_UNITY, FLOAT2FP(negMax));
-    this->invPosMaxFP = FP_DIV(FP_UNITY, FLOAT2FP(posMax));
+    this->table = NULL;
+    this->capture = false;
+    this->captured = false;
+    this->capturedFP = 0;
+    this->patchVolts = 0;
+    this->mainLevel = 0;
+    this->offsetLevel = 0;
+    this->slice = pwm_gpio_to_slice_num(offset);
+    this->pairedSlice = pwm_gpio_to_slice_num(offset+1) == slice && pwm_gpio_to_channel(offset) == PWM_CHAN_A;
+    SetRange(negMax, posMax);
     for(uint16_t i=0;i<2;i++) {
       uint slice_num = pwm_gpio_to_slice_num(i + offset);
       pwm_config cfg = pwm_get_default_config();
@@ -190,6 +255,20 @@ public:
       pwm_set_gpio_level(i + offset, 0);
     }
   }
+  void SetRange(double negMax, double posMax) {
+    this->negMax = negMax;
+    this->posMax = posMax;
+    this->negMaxFP = FLOAT2FP(negMax);
+    this->posMaxFP = FLOAT2FP(posMax);
+    this->audioMainLevel = (uint16_t)(res*(posMax*0.5)/negMax);
+    this->cvOffsetLevel = (uint16_t)(res*negMax/posMax);
+    // volts per PWM count on each pin, Q8, and full scale audio, Q-3
+    this->posCountVolts = (posMaxFP << 8)/res;
+    this->negCountVolts = (negMaxFP << 8)/res;
+    this->audioVolts = posMaxFP >> 3;
+    audioMap.Set(res>>1, res>>1, res);
+    cvMap.Set(res, -res/negMax, res);
+  }
   void Set(double level) {
     pwm_set_gpio_level(offset, (uint16_t)(level*res));
   }
@@ -197,12 +276,28 @@ public:
     pwm_set_gpio_level(offset+1, (uint16_t)(level*res));
   }
 
-  void SetCycles(int cycles) {
+  // the offset pin pushes the output up and the main pin down
+  void AUDIO_FUNC(PatchCycles)() {
+    patchVolts = ((int32_t)offsetLevel*posCountVolts - (int32_t)mainLevel*negCountVolts) >> 8;
+  }
+  void AUDIO_FUNC(SetCycles)(int cycles) {
+    mainLevel = cycles;
+    PatchCycles();
     pwm_set_gpio_level(offset, (uint16_t)cycles);
   }
-  void SetCyclesOffset(int cycles) {
+  void AUDIO_FUNC(SetCyclesOffset)(int cycles) {
+    offsetLevel = cycles;
+    PatchCycles();
     pwm_set_gpio_level(offset+1, (uint16_t)cycles);
   }
+  void AUDIO_FUNC(SetBoth)(uint16_t mainCycles, uint16_t offsetCycles) {
+    if(pairedSlice) {
+      pwm_set_both_levels(slice, mainCycles, offsetCycles);
+    } else {
+      pwm_set_gpio_level(offset, mainCycles);
+      pwm_set_gpio_level(offset+1, offsetCycles);
+    }
+  }
 
   /*
   void SetOutputVoltage(double v) {
@@ -212,15 +307,46 @@ public:
     Set(offset + 1, (v)/posMax);
   }
   */
-  void SetAudioFP(fp_signed v) {
-    fp_signed offsetCoef = FP_DIV(FP_UNITY, FLOAT2FP(VOCT_NOUT_MAX));
-    pwm_set_gpio_level(offset, FP_MUL(res, FP_MUL(posMaxFP>>1, invNegMaxFP)));
-    pwm_set_gpio_level(offset+1, (res>>1) + FP_MUL((res>>1), v));
+  void SetDither(DitherMode mode) { shaper.SetMode(mode); }
+  uint16_t AUDIO_FUNC(AudioLevel)(fp_signed v) { return shaper.Process(audioMap.Fine(v), res); }
+  // drop whole octaves until the pitch fits under the negative rail
+  fp_signed AUDIO_FUNC(FoldCV)(fp_signed v) {
+    if(v > negMaxFP) v -= ((v - negMaxFP + FP_UNITY - 1) >> FP_BITS) << FP_BITS;
+    return v;
   }
-  void SetCVFP(fp_signed v) {
-    while(v>negMaxFP) v-= FP_UNITY;
-    pwm_set_gpio_level(offset, res - FP_MUL(res, FP_MUL(v, invNegMaxFP)));
-    pwm_set_gpio_level(offset+1, FP_MUL(res, FP_MUL(invPosMaxFP, negMaxFP)));
+  uint16_t AUDIO_FUNC(CVLevel)(fp_signed v) { return shaper.Process(cvMap.Fine(FoldCV(v)), res); }
+  void AUDIO_FUNC(SetAudioLevel)(uint16_t level) { SetBoth(audioMainLevel, level); }
+  void AUDIO_FUNC(SetCVLevel)(uint16_t level) { SetBoth(level, cvOffsetLevel); }
+  void AUDIO_FUNC(SetAudioFP)(fp_signed v) {
+    if(capture) {
+      capturedFP = v;
+      captured = true;
+      return;
+    }
+    // audio swings half the positive range either side of 0V
+    patchVolts = (v*audioVolts) >> (FP_BITS-2);
+    SetAudioLevel(AudioLevel(v));
+  }
+  void AUDIO_FUNC(SetCVFP)(fp_signed v) {
+    v = FoldCV(v);
+    patchVolts = v;
+    SetCVLevel(shaper.Process(cvMap.Fine(v), res));
+  }
+
+  // 0V and up through the calibration table, driven from the offset pin alone
+  uint16_t AUDIO_FUNC(VoltsLevel)(fp_signed v) { return shaper.Process(table->Lookup(v), res); }
+  void AUDIO_FUNC(SetVoltsFP)(fp_signed v) {
+    patchVolts = v;
+    SetBoth(0, VoltsLevel(v));
+  }
+
+  // block conversion, so a block can be rendered ahead and written out one
+  // level per sample with SetAudioLevel/SetCVLevel
+  void AudioLevels(const fp_signed* in, uint16_t* out, int n) {
+    for(int i=0;i<n;i++) out[i] = AudioLevel(in[i]);
+  }
+  void CVLevels(const fp_signed* in, uint16_t* out, int n) {
+    for(int i=0;i<n;i++) out[i] = CVLevel(in[i]);
   }
 };
 
@@ -236,6 +362,24 @@ public:
   fp_signed analogIn[NUM_WORDS];
   AnalogOut* voctOut[NUM_WORDS];
   AnalogOut* cvOut[NUM_WORDS];
+  // the objects behind trigIn/voctOut/cvOut, side by side rather than
+  // spread over the heap; a word's two outputs are adjacent
+  GateTrigger triggers[NUM_WORDS];
+  AnalogOut outputs[NUM_WORDS][2];
+  // tempo and phase of whatever clocks the trigger inputs, kept up to date
+  // every sample for any word to follow
+  ClockTracker clocks[NUM_WORDS];
+  CalibrationData calibration;
+  bool calibrated;
+  int timerInterval;
+  static volatile bool _parkCore1_;
+  static volatile bool _core1Parked_;
+  // time_us_32 at the first audio sample, i.e. time from reset
+  static volatile uint32_t _firstSampleUs_;
+  // longest audio interrupt since the last ResetAudioStats, in us
+  static volatile uint32_t _isrWorstUs_;
+  // longest a flash write has held interrupts, and so audio, off, in us
+  static volatile uint32_t _flashStallUs_;
 
   static void controlHandler(uint gpio, uint32_t events) {
     for(int i=0; i<NUM_WORDS; i++) {
@@ -243,15 +387,27 @@ public:
     }
   }
 
-  static bool audioHandler(struct repeating_timer *t) {
+  static bool AUDIO_FUNC(audioHandler)(struct repeating_timer *t) {
+    uint32_t start = time_us_32();
+    if(_firstSampleUs_ == 0) _firstSampleUs_ = start;
     while(multicore_fifo_rvalid()) {
       uint32_t val = multicore_fifo_pop_blocking();
       _tlwhw_->analogIn[val>>24] = val & 0x00FFFFFF;
     }
+    for(int i=0;i<NUM_WORDS;i++) _tlwhw_->clocks[i].Process(!gpio_get(TRIG_IN[i]));
     if(_audioCallback_ != NULL) _audioCallback_();
+    uint32_t elapsed = time_us_32() - start;
+    if(elapsed > _isrWorstUs_) _isrWorstUs_ = elapsed;
     return true;
   }
 
+  // core1 runs its ADC loop from flash, so it waits here in RAM while flash is written
+  static void __not_in_flash_func(core1Park)() {
+    _core1Parked_ = true;
+    while(_parkCore1_) tight_loop_contents();
+    _core1Parked_ = false;
+  }
+
   static void core1Entry() {
     uint16_t activeAdcChannel = 0;
     uint32_t channelAccumulators[NUM_WORDS];
@@ -261,6 +417,7 @@ public:
       channelAccumulators[i] = 0;
     }
     while(1) {
+      if(_parkCore1_) core1Park();
       if(multicore_fifo_wready()) {
         for(int i=0;i<3;i++) {
           channelAccumulators[activeAdcChannel] = ((adc_read()<<2) + channelAccumulators[activeAdcChannel]*3)>>2;
@@ -272,31 +429,109 @@ public:
     }
   }
 
+  // brings up the outputs, trigger inputs and the audio timer; the display
+  // is left to InitDisplay so a module powered up in a running rack
+  // doesn't miss the first clocks while the I2C setup goes out
   void Init(void (*audioCallback)(void)) {
     if(_tlwhw_ == NULL) {
-      display = new U8G2_SSD1306_128X64_NONAME_F_HW_I2C(U8G2_R0, U8X8_PIN_NONE, 5, 4);
-      display->setBusClock(400000);
-      display->begin();
+      display = NULL;
       for(int i=0; i<NUM_WORDS; i++) {
         control[i] = new ButtonAndEncoder(TOP_BTN_CCW[i], ENC_BTN_CW[i]);
         gpio_set_irq_enabled_with_callback(TOP_BTN_CCW[i], GPIO_IRQ_EDGE_FALL, true, &controlHandler);
         gpio_set_irq_enabled_with_callback(ENC_BTN_CW[i], GPIO_IRQ_EDGE_FALL, true, &controlHandler);
-        trigIn[i]   = new GateTrigger(TRIG_IN[i]);
+        trigIn[i]   = &triggers[i];
+        trigIn[i]->Init(TRIG_IN[i]);
         analogIn[i] = 0;
-        voctOut[i]  = new AnalogOut(VOCT_OFFSET[i], 1024, VOCT_NOUT_MAX, VOCT_POUT_MAX);
-        cvOut[i]    = new AnalogOut(CV_OFFSET[i], 1024, CV_NOUT_MAX, CV_POUT_MAX);
+        voctOut[i]  = &outputs[i][0];
+        voctOut[i]->Init(VOCT_OFFSET[i], 1024, VOCT_NOUT_MAX, VOCT_POUT_MAX);
+        cvOut[i]    = &outputs[i][1];
+        cvOut[i]->Init(CV_OFFSET[i], 1024, CV_NOUT_MAX, CV_POUT_MAX);
+        voctOut[i]->table = &calibration.voct[i];
+        cvOut[i]->table = &calibration.cv[i];
       }
+      calibrated = LoadCalibration(&calibration, 1024);
 
       multicore_launch_core1(core1Entry);
 
+      // the audio interrupt on this core reads SIN_LUT through INTERP0
+      InterpInit(interp0, SIN_BITS);
       this->_audioCallback_ = audioCallback;
-      add_repeating_timer_us(-TIMER_INTERVAL, audioHandler, NULL, &_timer_);
+      this->timerInterval = TIMER_INTERVAL;
+      add_repeating_timer_us(-timerInterval, audioHandler, NULL, &_timer_);
       _tlwhw_ = this;
     }
   }
 
+  void InitDisplay() {
+    if(display != NULL) return;
+    display = new U8G2_SSD1306_128X64_NONAME_F_HW_I2C(U8G2_R0, U8X8_PIN_NONE, 5, 4);
+    display->setBusClock(400000);
+    display->begin();
+    display->setFont(u8g2_font_pixzillav1_tf);
+    display->setFontRefHeightExtendedText();
+    display->setDrawColor(1);
+    display->setFontPosTop();
+    display->setFontDirection(0);
+  }
+
+  void ResetAudioStats() { _isrWorstUs_ = 0; }
+
   void SetAudioCallback(void (*audioCallback)(void)) { _audioCallback_ = audioCallback; }
 
+  fp_signed InputVoltsFP(int i) { return calibration.inputs[i].Lookup(analogIn[i]); }
+
+  // The audio ISR runs on this core and reaches flash (vtables, the SDK's
+  // timer code), so it can't run while flash is written: interrupts are off
+  // for the whole write and audio stops with them. That's the datasheet's
+  // ~50ms a sector for an erase and under a millisecond a page for a
+  // program; _flashStallUs_ keeps the longest seen
+  void EraseFlash(uint32_t flashOffset, size_t len) {
+    _parkCore1_ = true;
+    while(!_core1Parked_) tight_loop_contents();
+    uint32_t ints = save_and_disable_interrupts();
+    uint32_t start = time_us_32();
+    flash_range_erase(flashOffset, ((len + FLASH_SECTOR_SIZE - 1)/FLASH_SECTOR_SIZE)*FLASH_SECTOR_SIZE);
+    NoteFlashStall(start);
+    restore_interrupts(ints);
+    _parkCore1_ = false;
+  }
+
+  // programs erased flash a page at a time, with audio stopped as above
+  void ProgramFlash(uint32_t flashOffset, const uint8_t* data, size_t len) {
+    static uint8_t page[FLASH_PAGE_SIZE];
+    _parkCore1_ = true;
+    while(!_core1Parked_) tight_loop_contents();
+    uint32_t ints = save_and_disable_interrupts();
+    uint32_t start = time_us_32();
+    for(size_t i=0;i<len;i+=FLASH_PAGE_SIZE) {
+      memset(page, 0xFF, FLASH_PAGE_SIZE);
+      memcpy(page, data + i, min((size_t)FLASH_PAGE_SIZE, len - i));
+      flash_range_program(flashOffset + i, page, FLASH_PAGE_SIZE);
+    }
+    NoteFlashStall(start);
+    restore_interrupts(ints);
+    _parkCore1_ = false;
+  }
+
+  void NoteFlashStall(uint32_t start) {
+    uint32_t elapsed = time_us_32() - start;
+    if(elapsed > _flashStallUs_) _flashStallUs_ = elapsed;
+  }
+
+  // rewrites whole sectors
+  void WriteFlash(uint32_t flashOffset, const uint8_t* data, size_t len) {
+    EraseFlash(flashOffset, len);
+    ProgramFlash(flashOffset, data, len);
+  }
+
+  void SaveCalibration() {
+    calibration.magic = CALIBRATION_MAGIC;
+    calibration.version = CALIBRATION_VERSION;
+    calibration.checksum = CalibrationChecksum(&calibration);
+    WriteFlash(CALIBRATION_FLASH_OFFSET, (const uint8_t*)&calibration, sizeof(CalibrationData));
+    calibrated = true;
+  }
+
   void Update() {
     for(int i=0; i<NUM_WORDS; i++) {
       control[i]->Update();
@@ -304,6 +539,11 @@ public:
   }
 };
 TLWHardware* TLWHardware::_tlwhw_ = NULL;
+volatile bool TLWHardware::_parkCore1_ = false;
+volatile bool TLWHardware::_core1Parked_ = false;
+volatile uint32_t TLWHardware::_firstSampleUs_ = 0;
+volatile uint32_t TLWHardware::_isrWorstUs_ = 0;
+volatile uint32_t TLWHardware::_flashStallUs_ = 0;
 void (*TLWHardware::_audioCallback_)(void) = NULL;
 
 #endif
\ No newline at end of file
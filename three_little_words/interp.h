@@ -0,0 +1,73 @@
+#ifndef INTERP_H
+#define INTERP_H
+
+#include <stdint.h>
+#include "hardware/interp.h"
+#include "fpmath.h"
+#include "constants.h"
+
+// Phase accumulators reading a table, on the SIO interpolators. Lane 0 adds
+// base0 (the delta) to accum0 (the phase) raw; lane 1 takes accum0 across,
+// shifts its top bits down into a word offset and adds base1 (the table).
+// One read of POP1 then gives the address for the current phase and steps
+// the phase, where the CPU would load, add, store, shift and scale.
+//
+// Each core has its own INTERP0 and INTERP1. Audio runs in the core0 timer
+// interrupt and owns INTERP0 there, set up once by InterpInit; code in the
+// main loop uses INTERP1, so the interrupt never has to save either one.
+// -DINTERP_IN_SOFTWARE puts the audio path back on the CPU for comparison.
+
+// tables are 2^bits words
+void InterpInit(interp_hw_t* interp, int bits) {
+  interp_config cfg = interp_default_config();
+  interp_config_set_add_raw(&cfg, true);
+  interp_set_config(interp, 0, &cfg);
+  cfg = interp_default_config();
+  interp_config_set_cross_input(&cfg, true);
+  interp_config_set_shift(&cfg, 32 - bits - 2);
+  interp_config_set_mask(&cfg, 2, bits + 1);
+  interp_set_config(interp, 1, &cfg);
+}
+
+inline fp_signed AUDIO_FUNC(softLutStep)(uint32_t& phase, uint32_t delta, const fp_signed* table, int bits) {
+  fp_signed out = table[phase >> (32 - bits)];
+  phase += delta;
+  return out;
+}
+
+// the phase goes in and comes back out, so any number of oscillators can
+// take turns on one interpolator
+inline fp_signed AUDIO_FUNC(interpLutStep)(interp_hw_t* interp, uint32_t& phase, uint32_t delta, const fp_signed* table) {
+  interp->accum[0] = phase;
+  interp->base[0] = delta;
+  interp->base[1] = (uintptr_t)table;
+  fp_signed out = *(const fp_signed*)interp->pop[1];
+  phase = interp->accum[0];
+  return out;
+}
+
+// n samples of one oscillator, where the interpolator only has to be
+// loaded once; return the phase to carry on from
+uint32_t AUDIO_FUNC(softLutBlock)(uint32_t phase, uint32_t delta, const fp_signed* table, int bits, fp_signed* out, int n) {
+  for(int i=0;i<n;i++) out[i] = softLutStep(phase, delta, table, bits);
+  return phase;
+}
+
+uint32_t AUDIO_FUNC(interpLutBlock)(interp_hw_t* interp, uint32_t phase, uint32_t delta, const fp_signed* table, fp_signed* out, int n) {
+  interp->accum[0] = phase;
+  interp->base[0] = delta;
+  interp->base[1] = (uintptr_t)table;
+  for(int i=0;i<n;i++) out[i] = *(const fp_signed*)interp->pop[1];
+  return interp->accum[0];
+}
+
+// what the audio path uses; INTERP0 has to have been set up for bits
+inline fp_signed AUDIO_FUNC(lutStep)(uint32_t& phase, uint32_t delta, const fp_signed* table, int bits) {
+#ifdef INTERP_IN_SOFTWARE
+  return softLutStep(phase, delta, table, bits);
+#else
+  return interpLutStep(interp0, phase, delta, table);
+#endif
+}
+
+#endif
@@ -0,0 +1,203 @@
+#ifndef PITCH_H
+#define PITCH_H
+
+#include <stdint.h>
+#include "fpmath.h"
+#include "constants.h"
+#include "dsp.h"
+
+// Pitch of an audio rate input, as a period in input samples (Q8) that
+// periodToVolts turns into V/oct. Both trackers take the input as
+// analogIn holds it at each sample, which is not a clean stream at the
+// engine rate: core1 goes round the three inputs, three conversions each
+// through a one pole smoother, and hands a value over whenever the FIFO has
+// room, so in 1 moves once per round of nine conversions (about 18us at
+// the ADC's 2us) on core1's timing rather than the sample clock. Samples
+// carry that much jitter, and one repeats whenever core1 falls behind. The
+// accuracy checked on the host fed the trackers an ideal stream, so it is
+// the best case for the module.
+
+#define PITCH_DECIMATION_BITS 2
+#define PITCH_DECIMATION (1<<PITCH_DECIMATION_BITS)
+#define PITCH_MAX_WINDOW 256
+// samples are kept as 11 bits so a window of squared differences fits 32
+#define PITCH_SAMPLE_SHIFT 3
+#define PITCH_MIN_LAG 2
+// YIN's threshold on the normalised difference, Q12
+#define PITCH_THRESHOLD ((4096*15)/100)
+// no crossing for this long and the zero crossing tracker gives up (20Hz)
+#define PITCH_MAX_PERIOD (SAMPLERATE/20)
+
+// volts from 33Hz, the same reference voct2freq counts from
+fp_signed AUDIO_FUNC(periodToVolts)(uint32_t period) {
+  return twolog((uint32_t)((SAMPLERATE*256.0)/33.0)) - twolog(period);
+}
+
+// Cheap path: time between rising edges of a Schmitt trigger around the
+// input's running mean, placed to a fraction of a sample between the two
+// samples either side and averaged over each control block. Clean single
+// partial waves only; a harmonic strong enough to cross twice a cycle
+// reads an octave up.
+class ZeroCrossingPitch {
+public:
+  // mean of the input, scaled up by 2^10
+  int32_t mean;
+  fp_signed hysteresis;
+  fp_signed last;
+  bool high;
+  uint32_t elapsed;
+  uint32_t lastFrac;
+  uint32_t sum;
+  int count;
+  uint32_t period;
+  ZeroCrossingPitch() {
+    mean = 0;
+    hysteresis = FP_UNITY/64;
+    last = 0;
+    high = false;
+    elapsed = PITCH_MAX_PERIOD;
+    lastFrac = 0;
+    sum = 0;
+    count = 0;
+    period = 0;
+  }
+  void AUDIO_FUNC(Process)(fp_signed x) {
+    mean += x - (mean >> 10);
+    x -= mean >> 10;
+    if(elapsed < PITCH_MAX_PERIOD) elapsed++;
+    if(!high && x > hysteresis) {
+      high = true;
+      uint32_t frac = ((hysteresis - last) << 8) / (x - last);
+      if(elapsed < PITCH_MAX_PERIOD) {
+        sum += (elapsed << 8) + frac - lastFrac;
+        count++;
+      }
+      elapsed = 0;
+      lastFrac = frac;
+    } else if(high && x < -hysteresis) {
+      high = false;
+    }
+    last = x;
+  }
+  // once a control block; keeps the last period until the input goes quiet
+  uint32_t AUDIO_FUNC(Period)() {
+    if(count > 0) period = sum/count;
+    else if(elapsed >= PITCH_MAX_PERIOD) period = 0;
+    sum = 0;
+    count = 0;
+    return period;
+  }
+};
+
+// Accurate path: YIN on the input boxcar averaged down by PITCH_DECIMATION,
+// over window samples at lags up to window, so it hears down to
+// SAMPLERATE/(PITCH_DECIMATION*window), 39Hz at 256. Frames of 2*window
+// samples are captured while the frame before is worked through a few
+// multiply-adds per sample, so the difference function costs the interrupt
+// the same small amount every sample and a result lands a frame after the
+// frame it came from.
+class YinPitch {
+public:
+  int16_t frames[2][2*PITCH_MAX_WINDOW];
+  int16_t* capture;
+  int16_t* analysis;
+  int window;
+  int steps;
+  int fill;
+  int32_t decimSum;
+  int decimCount;
+  // difference per lag, and normalised by the mean up to it in Q12
+  uint32_t diff[PITCH_MAX_WINDOW+1];
+  uint16_t norm[PITCH_MAX_WINDOW+1];
+  uint64_t cumulative;
+  int tau;
+  int j;
+  uint32_t acc;
+  uint32_t period;
+  YinPitch() {
+    SetWindow(256);
+  }
+  void SetWindow(int window) {
+    this->window = window;
+    // enough per sample to finish a frame's lags before the next frame is in
+    steps = (window + 2*PITCH_DECIMATION - 1)/(2*PITCH_DECIMATION);
+    capture = frames[0];
+    analysis = frames[1];
+    fill = 0;
+    decimSum = 0;
+    decimCount = 0;
+    tau = window + 1;
+    period = 0;
+  }
+  // input samples from the start of a frame to its result
+  int Latency() {
+    return 4*window*PITCH_DECIMATION;
+  }
+  void AUDIO_FUNC(Start)() {
+    cumulative = 0;
+    tau = 1;
+    j = 0;
+    acc = 0;
+  }
+  void AUDIO_FUNC(Process)(fp_signed x) {
+    decimSum += x;
+    if(++decimCount == PITCH_DECIMATION) {
+      capture[fill++] = decimSum >> (PITCH_DECIMATION_BITS + PITCH_SAMPLE_SHIFT);
+      decimSum = 0;
+      decimCount = 0;
+      if(fill == 2*window) {
+        int16_t* t = analysis;
+        analysis = capture;
+        capture = t;
+        fill = 0;
+        Start();
+      }
+    }
+    Step(steps);
+  }
+  // up to n terms of the difference function for the frame in analysis
+  void AUDIO_FUNC(Step)(int n) {
+    for(int k=0;k<n && tau<=window;k++) {
+      int32_t d = analysis[j] - analysis[j+tau];
+      acc += d*d;
+      if(++j == window) Lag();
+    }
+  }
+  // d(tau) is done, so normalise it by the mean of d(1..tau)
+  void AUDIO_FUNC(Lag)() {
+    cumulative += acc;
+    uint64_t n = cumulative ? (((uint64_t)acc*tau) << 12)/cumulative : 4096;
+    diff[tau] = acc;
+    norm[tau] = n > 0xFFFF ? 0xFFFF : n;
+    acc = 0;
+    j = 0;
+    if(++tau > window) Evaluate();
+  }
+  // the first dip under the threshold, followed down to its bottom and
+  // placed between lags with a parabola through the plain difference, which
+  // is closer to one than the normalised; nothing under it is unvoiced
+  void AUDIO_FUNC(Evaluate)() {
+    int t = PITCH_MIN_LAG;
+    while(t < window && norm[t] >= PITCH_THRESHOLD) t++;
+    if(t >= window) {
+      period = 0;
+      return;
+    }
+    while(t+1 < window && norm[t+1] < norm[t]) t++;
+    int64_t a = diff[t-1];
+    int64_t b = diff[t];
+    int64_t c = diff[t+1];
+    int64_t den = a - 2*b + c;
+    int32_t offset = den > 0 ? ((a - c) << 7)/den : 0;
+    offset = max(-128, min(128, (int)offset));
+    period = ((t << 8) + offset) << PITCH_DECIMATION_BITS;
+  }
+  // the whole analysis of one frame at once, for timing it
+  void Analyze(const int16_t* frame) {
+    analysis = (int16_t*)frame;
+    Start();
+    Step(window*window);
+  }
+};
+
+#endif
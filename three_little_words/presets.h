@@ -0,0 +1,181 @@
+#ifndef PRESETS_H
+#define PRESETS_H
+
+#include <stddef.h>
+#include <string.h>
+#include "hardware/flash.h"
+#include "utils.h"
+#include "calibration.h"
+
+#define PRESET_SLOTS 8
+#define PRESET_SECTORS 8
+#define PRESET_RECORD_SIZE FLASH_PAGE_SIZE
+#define PRESET_DATA_SIZE (PRESET_RECORD_SIZE - 16)
+#define PRESET_MAGIC 0x50574C33
+// just below the calibration sector
+#define PRESET_FLASH_OFFSET (CALIBRATION_FLASH_OFFSET - PRESET_SECTORS*FLASH_SECTOR_SIZE)
+#define PRESET_FLASH_SIZE (PRESET_SECTORS*FLASH_SECTOR_SIZE)
+#define PRESET_RECORDS_PER_SECTOR (FLASH_SECTOR_SIZE/PRESET_RECORD_SIZE)
+
+// one flash page, so a save is a single page program
+struct PresetRecord {
+  uint32_t magic;
+  uint32_t seq;
+  uint8_t slot;
+  uint8_t app;
+  uint16_t length;
+  uint8_t data[PRESET_DATA_SIZE];
+  uint32_t checksum;
+};
+
+uint32_t PresetChecksum(const PresetRecord* record) {
+  return fnv1a(record, offsetof(PresetRecord, checksum));
+}
+
+// Packs values little endian into a preset's data. Running past the end
+// clears ok rather than writing, so a caller checks once at the end.
+class PresetWriter {
+public:
+  uint8_t* data;
+  int length;
+  int size;
+  bool ok;
+  PresetWriter(uint8_t* data, int size) {
+    this->data = data;
+    this->length = 0;
+    this->size = size;
+    this->ok = true;
+  }
+  template<class T> void Put(T v) {
+    if(length + (int)sizeof(T) > size) {
+      ok = false;
+      return;
+    }
+    memcpy(data + length, &v, sizeof(T));
+    length += sizeof(T);
+  }
+};
+
+// Reading past the end gives zeros and clears ok, so presets saved by an
+// older build with less data still load.
+class PresetReader {
+public:
+  const uint8_t* data;
+  int length;
+  int position;
+  bool ok;
+  PresetReader(const uint8_t* data, int length) {
+    this->data = data;
+    this->length = length;
+    this->position = 0;
+    this->ok = true;
+  }
+  template<class T> T Get() {
+    T v = 0;
+    if(position + (int)sizeof(T) > length) {
+      ok = false;
+      return v;
+    }
+    memcpy(&v, data + position, sizeof(T));
+    position += sizeof(T);
+    return v;
+  }
+};
+
+// Log structured store over PRESET_SECTORS sectors. Every save appends a
+// record at head, so a sector is only erased once per PRESET_RECORDS_PER_SECTOR
+// saves and the erases go round the whole region. Before head moves into a
+// used sector, the records in it that are still the latest for their slot
+// are carried over to the start of the freshly erased sector. The latest
+// record for each slot is indexed at boot, so a recall reads it straight
+// from the memory mapped flash.
+template<class HW>
+class PresetStore {
+public:
+  HW* hw;
+  const PresetRecord* index[PRESET_SLOTS];
+  uint32_t head;
+  uint32_t seq;
+  int lastSlot;
+
+  const PresetRecord* RecordAt(uint32_t offset) {
+    return (const PresetRecord*)(XIP_BASE + PRESET_FLASH_OFFSET + offset);
+  }
+
+  bool IsValid(const PresetRecord* record) {
+    return record->magic == PRESET_MAGIC && record->slot < PRESET_SLOTS
+      && record->length <= PRESET_DATA_SIZE && record->checksum == PresetChecksum(record);
+  }
+
+  void Init(HW* hw) {
+    this->hw = hw;
+    head = 0;
+    seq = 0;
+    lastSlot = -1;
+    for(int i=0;i<PRESET_SLOTS;i++) index[i] = NULL;
+    for(uint32_t offset=0;offset<PRESET_FLASH_SIZE;offset+=PRESET_RECORD_SIZE) {
+      const PresetRecord* record = RecordAt(offset);
+      if(!IsValid(record)) continue;
+      if(index[record->slot] == NULL || record->seq > index[record->slot]->seq) index[record->slot] = record;
+      if(lastSlot < 0 || record->seq > seq) {
+        seq = record->seq;
+        lastSlot = record->slot;
+        head = (offset + PRESET_RECORD_SIZE) % PRESET_FLASH_SIZE;
+      }
+    }
+  }
+
+  const PresetRecord* Find(int slot) {
+    return slot >= 0 && slot < PRESET_SLOTS ? index[slot] : NULL;
+  }
+
+  bool SectorIsBlank(uint32_t offset) {
+    const uint32_t* words = (const uint32_t*)RecordAt(offset);
+    for(int i=0;i<FLASH_SECTOR_SIZE/4;i++) {
+      if(words[i] != 0xFFFFFFFF) return false;
+    }
+    return true;
+  }
+
+  // records carried over are stamped as new, so the highest seq is
+  // always the one just before head
+  void Append(PresetRecord* record) {
+    record->seq = ++seq;
+    record->checksum = PresetChecksum(record);
+    hw->ProgramFlash(PRESET_FLASH_OFFSET + head, (const uint8_t*)record, PRESET_RECORD_SIZE);
+    index[record->slot] = RecordAt(head);
+    head = (head + PRESET_RECORD_SIZE) % PRESET_FLASH_SIZE;
+  }
+
+  // when head reaches a sector that's in use, erase it and carry over the
+  // records in it that haven't been superseded, other than the one being saved
+  void PrepareSector(int savingSlot) {
+    if(head % FLASH_SECTOR_SIZE != 0 || SectorIsBlank(head)) return;
+    static PresetRecord carried[PRESET_SLOTS];
+    int numCarried = 0;
+    for(int i=0;i<PRESET_SLOTS;i++) {
+      if(i == savingSlot || index[i] == NULL) continue;
+      uint32_t offset = (uint32_t)((const uint8_t*)index[i] - (const uint8_t*)RecordAt(0));
+      if(offset/FLASH_SECTOR_SIZE != head/FLASH_SECTOR_SIZE) continue;
+      carried[numCarried++] = *index[i];
+      index[i] = NULL;
+    }
+    hw->EraseFlash(PRESET_FLASH_OFFSET + head, FLASH_SECTOR_SIZE);
+    for(int i=0;i<numCarried;i++) Append(&carried[i]);
+  }
+
+  void Save(int slot, int app, const uint8_t* data, int length) {
+    static PresetRecord record;
+    memset(&record, 0xFF, sizeof(PresetRecord));
+    PrepareSector(slot);
+    record.magic = PRESET_MAGIC;
+    record.slot = slot;
+    record.app = app;
+    record.length = length;
+    memcpy(record.data, data, length);
+    Append(&record);
+    lastSlot = slot;
+  }
+};
+
+#endif
@@ -0,0 +1,132 @@
+#ifndef QUANTIZER_H
+#define QUANTIZER_H
+
+#include <stdint.h>
+#include "fpmath.h"
+#include "constants.h"
+
+// largest edo, shared with Harnomia
+#define MAX_EDO 99
+#define QUANT_MASK_WORDS ((MAX_EDO+31)/32)
+// how far past a cell edge the input has to go before the note changes,
+// cut down on scales with notes closer than four times this
+#define QUANT_HYSTERESIS (FP_UNITY/240)
+
+// Scale shapes in 12-EDO steps, bit n for step n. Other edos take the
+// nearest step to each, and 0 stands for every step of the edo.
+#define QUANT_NUM_SCALES 7
+const char* const QUANT_SCALE_NAMES[QUANT_NUM_SCALES] = {"min", "maj", "pent", "hmin", "whole", "blues", "all"};
+const uint16_t QUANT_SCALES[QUANT_NUM_SCALES] = {
+  0b010110101101, // 0 2 3 5 7 8 10
+  0b101010110101, // 0 2 4 5 7 9 11
+  0b010010101001, // 0 3 5 7 10
+  0b100110101101, // 0 2 3 5 7 8 11
+  0b010101010101, // 0 2 4 6 8 10
+  0b010011101001, // 0 3 5 6 7 10
+  0
+};
+
+// Snaps volts to the nearest note of a scale in any edo. Note voltages are
+// rounded once from exact step/edo fractions, so they're within half an LSB
+// (0.04 cents) at any edo. The cell edges between neighbouring notes are
+// worked out when the scale is set, which leaves a binary search over one
+// octave per lookup, and none at all while the input stays in the cell of
+// the last note plus the hysteresis.
+class Quantizer {
+public:
+  int edo;
+  int size;
+  // in volts within the octave, ascending
+  uint16_t notes[MAX_EDO];
+  // bounds[i] is the bottom of notes[i]'s cell and bounds[size] the top of
+  // the last, which is bounds[0] an octave up; bounds[0] goes negative when
+  // the first cell reaches down into the octave below
+  int16_t bounds[MAX_EDO+1];
+  fp_signed hysteresis;
+  // last note, counted in scale notes from 0V, and its widened cell
+  int note;
+  fp_signed low;
+  fp_signed high;
+
+  Quantizer() {
+    uint32_t mask[QUANT_MASK_WORDS] = {1};
+    Set(12, mask);
+  }
+
+  // steps of the edo are in the scale when their bit in mask is set
+  void Set(int edo, const uint32_t* mask) {
+    this->edo = edo;
+    size = 0;
+    for(int s=0;s<edo;s++) {
+      if(mask[s>>5] & (1u<<(s&31))) notes[size++] = (s*FP_UNITY + edo/2)/edo;
+    }
+    if(size == 0) notes[size++] = 0;
+    int narrowest = FP_UNITY;
+    for(int i=1;i<size;i++) {
+      bounds[i] = (notes[i-1] + notes[i] + 1) >> 1;
+      narrowest = min(narrowest, notes[i] - notes[i-1]);
+    }
+    bounds[0] = (notes[size-1] - FP_UNITY + notes[0]) >> 1;
+    bounds[size] = bounds[0] + FP_UNITY;
+    narrowest = min(narrowest, notes[0] + FP_UNITY - notes[size-1]);
+    hysteresis = min(QUANT_HYSTERESIS, narrowest >> 2);
+    // nothing is inside an empty cell, so the next lookup searches
+    low = 1;
+    high = 0;
+  }
+
+  // one of the 12-EDO shapes above, moved up by root steps of the edo
+  void SetScale(int edo, int scale, int root) {
+    uint32_t mask[QUANT_MASK_WORDS] = {0};
+    if(QUANT_SCALES[scale] == 0) {
+      for(int s=0;s<edo;s++) mask[s>>5] |= 1u<<(s&31);
+    }
+    for(int d=0;d<12;d++) {
+      if(!(QUANT_SCALES[scale] & (1<<d))) continue;
+      int step = ((d*edo + 6)/12 + root) % edo;
+      mask[step>>5] |= 1u<<(step&31);
+    }
+    Set(edo, mask);
+  }
+
+  int AUDIO_FUNC(Quantize)(fp_signed volts) {
+    if(volts >= low && volts < high) return note;
+    int octave = volts >> FP_BITS;
+    int frac = volts & (FP_UNITY-1);
+    // the last bound at or under frac
+    int lo = 0;
+    int hi = size+1;
+    if(frac < bounds[0]) {
+      octave--;
+      frac += FP_UNITY;
+    }
+    while(hi - lo > 1) {
+      int mid = (lo + hi) >> 1;
+      if(bounds[mid] <= frac) lo = mid;
+      else hi = mid;
+    }
+    if(lo == size) {
+      octave++;
+      lo = 0;
+    }
+    note = octave*size + lo;
+    low = octave*FP_UNITY + bounds[lo] - hysteresis;
+    high = octave*FP_UNITY + bounds[lo+1] + hysteresis;
+    return note;
+  }
+
+  int AUDIO_FUNC(Octave)(int note) {
+    return note >= 0 ? note/size : -((size - 1 - note)/size);
+  }
+
+  int AUDIO_FUNC(Degree)(int note) {
+    return note - Octave(note)*size;
+  }
+
+  fp_signed AUDIO_FUNC(Volts)(int note) {
+    int octave = Octave(note);
+    return octave*FP_UNITY + notes[note - octave*size];
+  }
+};
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef REGISTRY_H
+#define REGISTRY_H
+
+#include <stddef.h>
+#include <new>
+
+class App;
+
+// Apps and words are listed once, in the APPS and WORDS tables in apps.h.
+// Each entry carries the name, the storage it needs and a factory, so the
+// firmware sizes word slots from the table at compile time and host tools
+// can walk every app without knowing the classes. An entry can also carry
+// values for its first few params in place of the ones the constructor
+// sets, so one class can be listed more than once under its own settings.
+struct AppEntry {
+  const char* name;
+  size_t size;
+  size_t align;
+  // builds the app in slot, or on the heap when slot is NULL
+  App* (*make)(void* slot);
+  // NULL when the constructor's are the defaults
+  const int* defaults;
+  int numDefaults;
+};
+
+struct WordEntry {
+  const char* name;
+  size_t size;
+  size_t align;
+  App* (*make)(void* slot, int wordIndex);
+  // runs n words of this type for one sample
+  void (*process)(App* const* words, int n);
+  const int* defaults;
+  int numDefaults;
+};
+
+template<class T> App* makeApp(void* slot) {
+  return slot != NULL ? new(slot) T() : new T();
+}
+
+template<class T> App* makeWord(void* slot, int wordIndex) {
+  return new(slot) T(wordIndex);
+}
+
+// runs each word's Process without going through the vtable; types that
+// keep their channels in arrays give their own loop with BATCH_WORD_ENTRY
+template<class T> void AUDIO_FUNC(processWords)(App* const* words, int n) {
+  for(int i=0;i<n;i++) static_cast<T*>(words[i])->T::Process();
+}
+
+#define APP_ENTRY(name, T) { name, sizeof(T), alignof(T), makeApp<T>, NULL, 0 }
+#define WORD_ENTRY(name, T) { name, sizeof(T), alignof(T), makeWord<T>, processWords<T>, NULL, 0 }
+#define BATCH_WORD_ENTRY(name, T) { name, sizeof(T), alignof(T), makeWord<T>, T::ProcessBatch, NULL, 0 }
+// defaults is an array of the values, in the order the class adds its params
+#define APP_ENTRY_DEFAULTS(name, T, defaults) \
+  { name, sizeof(T), alignof(T), makeApp<T>, defaults, int(sizeof(defaults)/sizeof(defaults[0])) }
+#define WORD_ENTRY_DEFAULTS(name, T, defaults) \
+  { name, sizeof(T), alignof(T), makeWord<T>, processWords<T>, defaults, int(sizeof(defaults)/sizeof(defaults[0])) }
+
+template<class E, size_t N> constexpr int registrySize(const E (&)[N]) {
+  return N;
+}
+
+template<class E, size_t N> constexpr size_t registryMaxSize(const E (&entries)[N]) {
+  size_t size = 0;
+  for(size_t i=0;i<N;i++) if(entries[i].size > size) size = entries[i].size;
+  return size;
+}
+
+template<class E, size_t N> constexpr size_t registryMaxAlign(const E (&entries)[N]) {
+  size_t align = 1;
+  for(size_t i=0;i<N;i++) if(entries[i].align > align) align = entries[i].align;
+  return align;
+}
+
+constexpr bool registryNameIs(const char* a, const char* b) {
+  while(*a && *a == *b) {
+    a++;
+    b++;
+  }
+  return *a == *b;
+}
+
+// index of an entry by name, -1 if missing; usable in constant expressions
+template<class E, size_t N> constexpr int registryFind(const E (&entries)[N], const char* name) {
+  for(size_t i=0;i<N;i++) if(registryNameIs(entries[i].name, name)) return i;
+  return -1;
+}
+
+#endif
@@ -0,0 +1,138 @@
+#ifndef SWAR_H
+#define SWAR_H
+
+#include <stdint.h>
+#include "fpmath.h"
+#include "constants.h"
+
+// Two Q14 samples packed into one word, first sample in the low half. The
+// M0+ has no SIMD, but adds, shifts and masks on a packed word do both
+// lanes at once as long as carries are kept from crossing between them.
+// Lanes hold 16 bits, so anything summed must stay within +-2.
+typedef uint32_t q14x2;
+#define SWAR_SIGNS 0x80008000u
+#define SWAR_LANES 0x00010001u
+
+inline q14x2 swarPack(fp_signed lo, fp_signed hi) {
+  return (uint16_t)lo | ((uint32_t)(uint16_t)hi << 16);
+}
+inline fp_signed swarLo(q14x2 v) { return (int16_t)v; }
+inline fp_signed swarHi(q14x2 v) { return (int32_t)v >> 16; }
+
+// wrapping add and subtract per lane
+inline q14x2 swarAdd(q14x2 a, q14x2 b) {
+  return ((a & ~SWAR_SIGNS) + (b & ~SWAR_SIGNS)) ^ ((a ^ b) & SWAR_SIGNS);
+}
+inline q14x2 swarSub(q14x2 a, q14x2 b) {
+  return ((a | SWAR_SIGNS) - (b & ~SWAR_SIGNS)) ^ ((a ^ ~b) & SWAR_SIGNS);
+}
+
+// arithmetic shift right per lane: shift, drop what fell in from the high
+// lane, then sign extend each lane from its new top bit
+inline q14x2 swarShr(q14x2 v, int shift) {
+  q14x2 s = (v >> shift) & ((0xFFFFu >> shift) * SWAR_LANES);
+  q14x2 sign = SWAR_SIGNS >> shift;
+  return swarSub(s ^ sign, sign);
+}
+
+// clamp each lane to [-1, 1); a lane is out of range when its top two bits
+// differ, and is then replaced by the rail on its side
+inline q14x2 swarClip(q14x2 v) {
+  q14x2 over = ((v ^ (v << 1)) & SWAR_SIGNS) >> 15;
+  q14x2 negative = (v & SWAR_SIGNS) >> 15;
+  q14x2 rails = ((FP_UNITY-1) * SWAR_LANES) ^ (negative * 0xFFFF);
+  q14x2 mask = over * 0xFFFF;
+  return (v & ~mask) | (rails & mask);
+}
+
+// there's no packed multiply, so gain splits the lanes for two MULS
+inline q14x2 swarGain(q14x2 v, fp_signed gain) {
+  return swarPack(FP_MUL(swarLo(v), gain), FP_MUL(swarHi(v), gain));
+}
+
+// Block kernels over n packed words (2n samples), each next to the scalar
+// version over 2n samples for SwarBenchmark to compare. Both live in RAM
+// with the rest of the audio path so the comparison is the one that matters.
+
+void AUDIO_FUNC(SwarMix)(q14x2* out, const q14x2* a, const q14x2* b, int n) {
+  for(int i=0;i<n;i++) out[i] = swarClip(swarAdd(a[i], b[i]));
+}
+void AUDIO_FUNC(ScalarMix)(fp_signed* out, const fp_signed* a, const fp_signed* b, int n) {
+  for(int i=0;i<n;i++) out[i] = max(-FP_UNITY, min(FP_UNITY-1, a[i] + b[i]));
+}
+
+void AUDIO_FUNC(SwarScale)(q14x2* out, const q14x2* in, fp_signed gain, int n) {
+  for(int i=0;i<n;i++) out[i] = swarGain(in[i], gain);
+}
+void AUDIO_FUNC(ScalarScale)(fp_signed* out, const fp_signed* in, fp_signed gain, int n) {
+  for(int i=0;i<n;i++) out[i] = FP_MUL(in[i], gain);
+}
+
+void AUDIO_FUNC(SwarClipBlock)(q14x2* buf, int n) {
+  for(int i=0;i<n;i++) buf[i] = swarClip(buf[i]);
+}
+void AUDIO_FUNC(ScalarClipBlock)(fp_signed* buf, int n) {
+  for(int i=0;i<n;i++) buf[i] = max(-FP_UNITY, min(FP_UNITY-1, buf[i]));
+}
+
+// y += (x - y) >> shift for two channels side by side; returns the state
+q14x2 AUDIO_FUNC(SwarOnePole)(q14x2 y, const q14x2* in, q14x2* out, int shift, int n) {
+  for(int i=0;i<n;i++) {
+    y = swarAdd(y, swarShr(swarSub(in[i], y), shift));
+    out[i] = y;
+  }
+  return y;
+}
+fp_signed AUDIO_FUNC(ScalarOnePole)(fp_signed y, const fp_signed* in, fp_signed* out, int shift, int n) {
+  for(int i=0;i<n;i++) {
+    y += (in[i] - y) >> shift;
+    out[i] = y;
+  }
+  return y;
+}
+
+typedef enum { SWAR_MIX, SWAR_SCALE, SWAR_CLIP, SWAR_ONEPOLE, NUM_SWAR_KERNELS } SwarKernel;
+
+// Best of reps runs over a block, in ns per sample for the packed and the
+// scalar version of each kernel. tests/swar_bench.cpp builds it on the
+// host, where a block is too quick for time_us_32, and times batches there.
+#define SWAR_BENCH_PAIRS 128
+void SwarBenchmark(uint32_t* swarNs, uint32_t* scalarNs, int reps) {
+  static q14x2 pa[SWAR_BENCH_PAIRS], pb[SWAR_BENCH_PAIRS], pout[SWAR_BENCH_PAIRS];
+  static fp_signed sa[2*SWAR_BENCH_PAIRS], sb[2*SWAR_BENCH_PAIRS], sout[2*SWAR_BENCH_PAIRS];
+  for(int i=0;i<2*SWAR_BENCH_PAIRS;i++) {
+    sa[i] = (i*2731)%(2*FP_UNITY) - FP_UNITY;
+    sb[i] = (i*1237)%(2*FP_UNITY) - FP_UNITY;
+  }
+  for(int i=0;i<SWAR_BENCH_PAIRS;i++) {
+    pa[i] = swarPack(sa[2*i], sa[2*i+1]);
+    pb[i] = swarPack(sb[2*i], sb[2*i+1]);
+  }
+  for(int k=0;k<NUM_SWAR_KERNELS;k++) {
+    uint32_t bestSwar = 0xFFFFFFFF;
+    uint32_t bestScalar = 0xFFFFFFFF;
+    for(int r=0;r<reps;r++) {
+      uint32_t start = time_us_32();
+      switch(k) {
+        case SWAR_MIX: SwarMix(pout, pa, pb, SWAR_BENCH_PAIRS); break;
+        case SWAR_SCALE: SwarScale(pout, pa, FP_UNITY/3, SWAR_BENCH_PAIRS); break;
+        case SWAR_CLIP: SwarClipBlock(pout, SWAR_BENCH_PAIRS); break;
+        case SWAR_ONEPOLE: SwarOnePole(0, pa, pout, 4, SWAR_BENCH_PAIRS); break;
+      }
+      uint32_t middle = time_us_32();
+      switch(k) {
+        case SWAR_MIX: ScalarMix(sout, sa, sb, 2*SWAR_BENCH_PAIRS); break;
+        case SWAR_SCALE: ScalarScale(sout, sa, FP_UNITY/3, 2*SWAR_BENCH_PAIRS); break;
+        case SWAR_CLIP: ScalarClipBlock(sout, 2*SWAR_BENCH_PAIRS); break;
+        case SWAR_ONEPOLE: ScalarOnePole(0, sa, sout, 4, 2*SWAR_BENCH_PAIRS); break;
+      }
+      uint32_t end = time_us_32();
+      bestSwar = min(bestSwar, middle - start);
+      bestScalar = min(bestScalar, end - middle);
+    }
+    swarNs[k] = (bestSwar*1000)/(2*SWAR_BENCH_PAIRS);
+    scalarNs[k] = (bestScalar*1000)/(2*SWAR_BENCH_PAIRS);
+  }
+}
+
+#endif
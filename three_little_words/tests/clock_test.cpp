@@ -0,0 +1,138 @@
+// Host harness for clock.h: feeds ClockTracker and ClockOut synthetic
+// clocks, steady, jittered, changing tempo and with pulses missing, and
+// reports the time to lock and how far ClockOut's ticks land from where
+// they should, over the second half of each run once it has settled.
+// From this directory:
+//
+//   g++ -std=gnu++17 -O2 -DAUDIO_CODE_IN_FLASH clock_test.cpp -o clock_test && ./clock_test
+//
+// Prints a line per case and exits non-zero if one never locks, misses
+// ticks or lands a tick more than CLOCK_TEST_MAX_MS off.
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include "../clock.h"
+
+// worst tick error allowed, beyond the +-5ms jitter case's own
+#define CLOCK_TEST_MAX_MS 6.0
+// samples a pulse stays high
+#define CLOCK_TEST_PULSE 40
+
+struct ClockCase {
+  const char* name;
+  // period in samples, changing from p0 to p1 at sample changeAt
+  double p0, p1;
+  int changeAt;
+  // edges moved by up to +-jitter samples, every dropEvery'th left out
+  int jitter;
+  int dropEvery;
+  int ratio;
+  int swing;
+};
+
+struct ClockResult {
+  double lockMs;
+  double rmsMs;
+  double maxMs;
+  int ticks;
+  int expected;
+};
+
+double ms(double samples) { return (samples*1000.0)/SAMPLE_RATE; }
+
+ClockResult run(const ClockCase& c, int seconds) {
+  ClockTracker tracker;
+  ClockOut out;
+  out.Set(c.ratio, c.swing);
+  int n = (int)(seconds*SAMPLE_RATE);
+
+  std::vector<double> ideal;
+  for(double t=1000;t<n;t += t < c.changeAt ? c.p0 : c.p1) ideal.push_back(t);
+  std::vector<int> edges;
+  for(size_t i=0;i<ideal.size();i++) {
+    if(c.dropEvery && i > 10 && i%c.dropEvery == (size_t)c.dropEvery-1) continue;
+    int jitter = c.jitter ? rand()%(2*c.jitter+1) - c.jitter : 0;
+    edges.push_back((int)llround(ideal[i]) + jitter);
+  }
+
+  std::vector<int> ticks;
+  size_t next = 0;
+  int high = 0;
+  for(int s=0;s<n;s++) {
+    if(next < edges.size() && s == edges[next]) {
+      high = CLOCK_TEST_PULSE;
+      next++;
+    }
+    bool level = high > 0;
+    bool edge = high == CLOCK_TEST_PULSE;
+    if(high) high--;
+    tracker.Process(level);
+    if(out.Process(tracker, edge)) ticks.push_back(s);
+  }
+
+  // where the ticks belong: mult over each div of the ideal edges, every
+  // other one pushed late by swing, from the first edge that can lock
+  int mult = CLOCK_MULTS[c.ratio];
+  int div = CLOCK_DIVS[c.ratio];
+  if(c.swing != 50 && (mult & 1)) {
+    mult *= 2;
+    div *= 2;
+  }
+  std::vector<double> grid;
+  for(size_t i=3;i+1<ideal.size();i+=div) {
+    double span = 0;
+    for(int d=0;d<div && i+d+1<ideal.size();d++) span += ideal[i+d+1] - ideal[i+d];
+    double step = span/mult;
+    for(int k=0;k<mult;k++) {
+      double position = (k & 1) ? (k-1)*step + (2*step*c.swing)/100.0 : k*step;
+      grid.push_back(ideal[i] + position);
+    }
+  }
+
+  ClockResult r = {ms(tracker.lockTime), 0, 0, 0, 0};
+  if(ticks.empty() || grid.empty()) return r;
+  // a tick a little after the last grid point still belongs to it
+  double slack = (CLOCK_TEST_MAX_MS*SAMPLE_RATE)/1000.0;
+  double squares = 0;
+  size_t g = 0;
+  for(int t : ticks) {
+    if(t < n/2 || t > grid.back() + slack) continue;
+    while(g+1 < grid.size() && fabs(grid[g+1] - t) < fabs(grid[g] - t)) g++;
+    double error = t - grid[g];
+    squares += error*error;
+    r.maxMs = fmax(r.maxMs, ms(fabs(error)));
+    r.ticks++;
+  }
+  for(double p : grid) if(p >= n/2 && p <= ticks.back()) r.expected++;
+  if(r.ticks > 0) r.rmsMs = ms(sqrt(squares/r.ticks));
+  return r;
+}
+
+int main() {
+  const ClockCase cases[] = {
+    {"120bpm x1", 20000, 20000, 0, 0, 0, CLOCK_RATIO_X1, 50},
+    {"120bpm x4", 20000, 20000, 0, 0, 0, 7, 50},
+    {"120bpm /3", 20000, 20000, 0, 0, 0, 2, 50},
+    {"120bpm +-1ms x4", 20000, 20000, 0, 40, 0, 7, 50},
+    {"120bpm +-1ms x1 raw", 20000, 20000, 0, 40, 0, CLOCK_RATIO_X1, 50},
+    {"120bpm +-5ms x4", 20000, 20000, 0, 200, 0, 7, 50},
+    {"120->140bpm x4", 20000, 17142.857, 200000, 0, 0, 7, 50},
+    {"120bpm drop 1/7 x4", 20000, 20000, 0, 0, 7, 7, 50},
+    {"120bpm x2 swing 66", 20000, 20000, 0, 0, 0, 5, 66},
+    {"120bpm x1 swing 60", 20000, 20000, 0, 0, 0, CLOCK_RATIO_X1, 60},
+    {"173bpm x3", 13846.15, 13846.15, 0, 0, 0, 6, 50},
+  };
+  int failures = 0;
+  for(const ClockCase& c : cases) {
+    ClockResult r = run(c, 20);
+    bool ok = r.lockMs > 0 && r.ticks >= r.expected && r.maxMs <= CLOCK_TEST_MAX_MS;
+    if(!ok) failures++;
+    printf("%-22s lock %6.1fms  rms %.3fms  max %.3fms  ticks %d/%d%s\n", c.name,
+      r.lockMs, r.rmsMs, r.maxMs, r.ticks, r.expected, ok ? "" : "  FAIL");
+  }
+  printf("%d failures\n", failures);
+  return failures != 0;
+}
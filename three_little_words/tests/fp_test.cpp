@@ -0,0 +1,118 @@
+// Host test of fp.hpp's exact arithmetic: wmul, wdiv and reciprocal against
+// a 128-bit reference, the ARMv6-M partial product multiply against the
+// plain 64-bit product, and the truncation of sdiv32/sdiv64 for every sign.
+// On the board sdiv32/sdiv64 go through the SIO divider, which truncates
+// the same way; here they are plain division. From this directory:
+//
+//   g++ -std=gnu++17 -O2 fp_test.cpp -o fp_test && ./fp_test
+//
+// Prints the failures, if any, and exits non-zero on one.
+
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include "../fp.hpp"
+
+using namespace fp;
+using namespace fp::constants;
+
+int failures = 0;
+
+void fail(const char* what, int64_t a, int64_t b, int64_t want, int64_t got) {
+  if(failures++ < 10) printf("%s(%lld, %lld): want %lld got %lld\n", what,
+    (long long)a, (long long)b, (long long)want, (long long)got);
+}
+
+template<intmax_t E> int32_t raw(const fp_t<int32_t,E>& v) {
+  return (int32_t)(v << int_<E>);
+}
+
+// a/d at exponent R from operands at EA and ED, truncated toward zero, and
+// a*d at R rounded down, both worked out in 128 bits
+template<int EA, int ED, int R> void checkExact(std::mt19937& g, int n) {
+  for(int i=0;i<n;i++) {
+    int32_t ab = g(), db = g();
+    if(i%3 == 0) db = (int32_t)(g()%2000) - 1000;
+    if(i%5 == 0) ab >>= g()%31;
+    if(i%7 == 0) db = 1 << (g()%31);
+    if(db == 0) db = 1;
+    fp_t<int32_t,EA> a(ab, false);
+    fp_t<int32_t,ED> d(db, false);
+
+    constexpr int S = R - EA + ED;
+    __int128 num = S >= 0 ? (__int128)ab * ((__int128)1 << S) : ab;
+    __int128 q = num / db;
+    if(S < 0) q /= (__int128)1 << -S;
+    int32_t want = (int32_t)(int64_t)q;
+    int32_t got = raw(a.template wdiv<R>(d));
+    if(got != want) fail("wdiv", ab, db, want, got);
+    got = raw(reciprocal<fp_t<int32_t,ED>>(d).template divide<R>(a));
+    if(got != want) fail("reciprocal", ab, db, want, got);
+
+    constexpr int M = EA + ED - R;
+    int64_t p = (int64_t)ab*db;
+    want = (int32_t)(M >= 0 ? p >> M : p*((int64_t)1 << -M));
+    got = raw(a.template wmul<R>(d));
+    if(got != want) fail("wmul", ab, db, want, got);
+  }
+}
+
+void checkMultiply(std::mt19937& g, int n) {
+  const uint32_t edges[] = {0, 1, 0xFFFF, 0x10000, 0x7FFFFFFF, 0x80000000, 0xFFFFFFFF};
+  for(uint32_t a : edges) {
+    for(uint32_t b : edges) {
+      if(detail::umul32x32_parts(a, b) != (uint64_t)a*b) fail("umul32x32_parts", a, b, (uint64_t)a*b, detail::umul32x32_parts(a, b));
+      int64_t s = (int64_t)(int32_t)a*(int32_t)b;
+      if(detail::smul32x32(a, b) != s) fail("smul32x32", (int32_t)a, (int32_t)b, s, detail::smul32x32(a, b));
+    }
+  }
+  for(int i=0;i<n;i++) {
+    uint32_t a = g(), b = g();
+    if(detail::umul32x32_parts(a, b) != (uint64_t)a*b) fail("umul32x32_parts", a, b, (uint64_t)a*b, detail::umul32x32_parts(a, b));
+    int64_t s = (int64_t)(int32_t)a*(int32_t)b;
+    if(detail::smul32x32(a, b) != s) fail("smul32x32", (int32_t)a, (int32_t)b, s, detail::smul32x32(a, b));
+  }
+}
+
+// quotient of the magnitudes, negated when the signs differ: truncation
+// toward zero, whatever the signs
+int64_t truncated(int64_t n, int64_t d) {
+  int64_t q = (n < 0 ? -n : n)/(d < 0 ? -d : d);
+  return (n < 0) != (d < 0) ? -q : q;
+}
+
+void checkDivide() {
+  const int32_t ns[] = {7, -7, 6, -6, 1, -1, 0, INT32_MAX, INT32_MIN + 1};
+  const int32_t ds[] = {2, -2, 3, -3, 7, -7, 1, -1, INT32_MAX};
+  for(int32_t n : ns) {
+    for(int32_t d : ds) {
+      int64_t want = truncated(n, d);
+      if(detail::sdiv32(n, d) != want) fail("sdiv32", n, d, want, detail::sdiv32(n, d));
+      int64_t wide = (int64_t)n * (1 << 20);
+      want = truncated(wide, d);
+      if(detail::sdiv64(wide, d) != want) fail("sdiv64", wide, d, want, detail::sdiv64(wide, d));
+    }
+  }
+  // through fp_t: -3.5/2 is -1.75 exactly, -7/2 in integers is -3
+  fp_t<int32_t,14> a(-7 << 13, false);
+  fp_t<int32_t,14> two(2 << 14, false);
+  if(raw(a.wdiv<14>(two)) != -(7 << 12)) fail("wdiv -3.5/2", -7 << 13, 2 << 14, -(7 << 12), raw(a.wdiv<14>(two)));
+  fp_t<int32_t,0> seven(-7, false);
+  fp_t<int32_t,0> half(2, false);
+  if(raw(seven.wdiv<0>(half)) != -3) fail("wdiv -7/2", -7, 2, -3, raw(seven.wdiv<0>(half)));
+}
+
+int main() {
+  std::mt19937 g(1);
+  checkExact<14,14,14>(g, 300000);
+  checkExact<14,0,14>(g, 300000);
+  checkExact<14,14,0>(g, 300000);
+  checkExact<10,0,10>(g, 300000);
+  checkExact<22,8,22>(g, 300000);
+  checkExact<30,16,14>(g, 300000);
+  checkExact<20,10,-5>(g, 300000);
+  checkMultiply(g, 1000000);
+  checkDivide();
+  printf("%s, %d failures\n", failures ? "FAILED" : "ok", failures);
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,164 @@
+// Host check and benchmark of swar.h: the packed lane operations against
+// plain int arithmetic, with the other lane set to show any carry leaking
+// across, the block kernels against their scalar versions, then timings of
+// both. A block takes well under a microsecond here, too short for
+// SwarBenchmark's time_us_32, so batches of blocks are timed instead. Host
+// numbers only show how the compiler treats the kernels; the ones that
+// count are what SWAR shows on the board. From this directory:
+//
+//   g++ -std=gnu++17 -O2 -DAUDIO_CODE_IN_FLASH swar_bench.cpp -o swar_bench && ./swar_bench
+//
+// Prints the failures, if any, and exits non-zero on one.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+
+using std::max;
+using std::min;
+
+uint32_t time_us_32() {
+  static auto start = std::chrono::steady_clock::now();
+  return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now() - start).count();
+}
+
+#include "../swar.h"
+
+int failures = 0;
+
+void fail(const char* what, int a, int b, int want, int got) {
+  if(failures++ < 10) printf("%s(%d, %d): want %d got %d\n", what, a, b, want, got);
+}
+
+int wrap(int v) { return (int16_t)(uint16_t)v; }
+int clip(int v) { return max(-FP_UNITY, min(FP_UNITY-1, v)); }
+
+// each lane against the plain result, with the other lane holding a value
+// that would show a carry or borrow leaking across
+void checkLanes() {
+  const int other[] = {-32768, -1, 0, 1, 32767};
+  for(int a=-2*FP_UNITY;a<2*FP_UNITY;a+=7) {
+    for(int b=-2*FP_UNITY;b<2*FP_UNITY;b+=61) {
+      for(int o : other) {
+        q14x2 pa = swarPack(a, o), pb = swarPack(b, o);
+        q14x2 qa = swarPack(o, a), qb = swarPack(o, b);
+        if(swarLo(swarAdd(pa, pb)) != wrap(a+b)) fail("swarAdd lo", a, b, wrap(a+b), swarLo(swarAdd(pa, pb)));
+        if(swarHi(swarAdd(qa, qb)) != wrap(a+b)) fail("swarAdd hi", a, b, wrap(a+b), swarHi(swarAdd(qa, qb)));
+        if(swarLo(swarSub(pa, pb)) != wrap(a-b)) fail("swarSub lo", a, b, wrap(a-b), swarLo(swarSub(pa, pb)));
+        if(swarHi(swarSub(qa, qb)) != wrap(a-b)) fail("swarSub hi", a, b, wrap(a-b), swarHi(swarSub(qa, qb)));
+      }
+    }
+    for(int o : other) {
+      for(int s=1;s<15;s++) {
+        if(swarLo(swarShr(swarPack(a, o), s)) != a >> s) fail("swarShr lo", a, s, a >> s, swarLo(swarShr(swarPack(a, o), s)));
+        if(swarHi(swarShr(swarPack(o, a), s)) != a >> s) fail("swarShr hi", a, s, a >> s, swarHi(swarShr(swarPack(o, a), s)));
+      }
+      if(swarLo(swarClip(swarPack(a, o))) != clip(a)) fail("swarClip lo", a, o, clip(a), swarLo(swarClip(swarPack(a, o))));
+      if(swarHi(swarClip(swarPack(o, a))) != clip(a)) fail("swarClip hi", a, o, clip(a), swarHi(swarClip(swarPack(o, a))));
+    }
+  }
+}
+
+// the packed kernels against the scalar ones on the same block
+void checkKernels() {
+  const int n = 64;
+  fp_signed sa[2*n], sb[2*n], sout[2*n];
+  q14x2 pa[n], pb[n], pout[n];
+  for(int i=0;i<2*n;i++) {
+    sa[i] = (i*2731)%(2*FP_UNITY) - FP_UNITY;
+    sb[i] = (i*1237)%(2*FP_UNITY) - FP_UNITY;
+  }
+  for(int i=0;i<n;i++) {
+    pa[i] = swarPack(sa[2*i], sa[2*i+1]);
+    pb[i] = swarPack(sb[2*i], sb[2*i+1]);
+  }
+  auto compare = [&](const char* what) {
+    for(int i=0;i<2*n;i++) {
+      fp_signed got = i & 1 ? swarHi(pout[i/2]) : swarLo(pout[i/2]);
+      if(got != sout[i]) fail(what, i, 0, sout[i], got);
+    }
+  };
+  SwarMix(pout, pa, pb, n);
+  ScalarMix(sout, sa, sb, 2*n);
+  compare("SwarMix");
+  SwarScale(pout, pa, FP_UNITY/3, n);
+  ScalarScale(sout, sa, FP_UNITY/3, 2*n);
+  compare("SwarScale");
+  for(int i=0;i<n;i++) pout[i] = swarAdd(pa[i], pb[i]);
+  for(int i=0;i<2*n;i++) sout[i] = sa[i] + sb[i];
+  SwarClipBlock(pout, n);
+  ScalarClipBlock(sout, 2*n);
+  compare("SwarClipBlock");
+  // the packed filter runs two channels, so feed the scalar one each lane
+  fp_signed lane[n], laneOut[n];
+  SwarOnePole(0, pa, pout, 4, n);
+  for(int h=0;h<2;h++) {
+    for(int i=0;i<n;i++) lane[i] = sa[2*i+h];
+    ScalarOnePole(0, lane, laneOut, 4, n);
+    for(int i=0;i<n;i++) sout[2*i+h] = laneOut[i];
+  }
+  compare("SwarOnePole");
+}
+
+#define BENCH_PAIRS SWAR_BENCH_PAIRS
+#define BENCH_BLOCKS 20000
+
+// best of a few batches, in ns per sample
+template<typename F> double timeBlocks(F run) {
+  double best = 1e9;
+  for(int r=0;r<5;r++) {
+    auto start = std::chrono::steady_clock::now();
+    for(int b=0;b<BENCH_BLOCKS;b++) run();
+    std::chrono::duration<double, std::nano> took = std::chrono::steady_clock::now() - start;
+    best = min(best, took.count()/((double)BENCH_BLOCKS*2*BENCH_PAIRS));
+  }
+  return best;
+}
+
+void bench() {
+  static q14x2 pa[BENCH_PAIRS], pb[BENCH_PAIRS], pout[BENCH_PAIRS];
+  static fp_signed sa[2*BENCH_PAIRS], sb[2*BENCH_PAIRS], sout[2*BENCH_PAIRS];
+  for(int i=0;i<2*BENCH_PAIRS;i++) {
+    sa[i] = (i*2731)%(2*FP_UNITY) - FP_UNITY;
+    sb[i] = (i*1237)%(2*FP_UNITY) - FP_UNITY;
+  }
+  for(int i=0;i<BENCH_PAIRS;i++) {
+    pa[i] = swarPack(sa[2*i], sa[2*i+1]);
+    pb[i] = swarPack(sb[2*i], sb[2*i+1]);
+  }
+  // the filter state is carried between blocks so the loops can't go
+  volatile q14x2 py = 0;
+  volatile fp_signed sy = 0;
+  double swarNs[NUM_SWAR_KERNELS] = {
+    timeBlocks([&]{ SwarMix(pout, pa, pb, BENCH_PAIRS); }),
+    timeBlocks([&]{ SwarScale(pout, pa, FP_UNITY/3, BENCH_PAIRS); }),
+    timeBlocks([&]{ SwarClipBlock(pout, BENCH_PAIRS); }),
+    timeBlocks([&]{ py = SwarOnePole(py, pa, pout, 4, BENCH_PAIRS); }),
+  };
+  double scalarNs[NUM_SWAR_KERNELS] = {
+    timeBlocks([&]{ ScalarMix(sout, sa, sb, 2*BENCH_PAIRS); }),
+    timeBlocks([&]{ ScalarScale(sout, sa, FP_UNITY/3, 2*BENCH_PAIRS); }),
+    timeBlocks([&]{ ScalarClipBlock(sout, 2*BENCH_PAIRS); }),
+    timeBlocks([&]{ sy = ScalarOnePole(sy, sa, sout, 4, 2*BENCH_PAIRS); }),
+  };
+  static const char* names[NUM_SWAR_KERNELS] = {"mix", "scale", "clip", "onepole"};
+  for(int k=0;k<NUM_SWAR_KERNELS;k++) {
+    printf("%-8s swar %6.3f ns  scalar %6.3f ns per sample\n", names[k], swarNs[k], scalarNs[k]);
+  }
+  // SwarBenchmark itself only has to run here
+  uint32_t coarseSwar[NUM_SWAR_KERNELS], coarseScalar[NUM_SWAR_KERNELS];
+  SwarBenchmark(coarseSwar, coarseScalar, 4);
+  // printed so the blocks aren't optimised away
+  printf("checksum %u %u %d\n", (unsigned)pout[BENCH_PAIRS-1], (unsigned)py, (int)(sout[0] + sy));
+}
+
+int main() {
+  checkLanes();
+  checkKernels();
+  bench();
+  printf("%d failures\n", failures);
+  return failures != 0;
+}
@@ -10,61 +10,238 @@
 #include "apps.h"
 #include "dsp.h"
 
-App* app;
+App* volatile app;
+App* volatile pendingApp = NULL;
+// the app faded out, for the loop to delete once the fade is done
+App* volatile outgoingApp = NULL;
+Crossfade appFade;
 int appIndex = 0;
+PresetStore<TLWHardware> presets;
+int presetSlot = 0;
 
-void audio_callback() {
-  app->Process();
+int controlCountdown = 0;
+#ifdef AUDIO_REPORT
+// SysTick cycles in the mod matrix, summed and worst, over blocks
+volatile uint32_t modCycles = 0;
+volatile uint32_t modWorst = 0;
+volatile uint32_t modBlocks = 0;
+// longest recallPreset, in us
+uint32_t recallWorstUs = 0;
+#endif
+
+void AUDIO_FUNC(audio_callback)() {
+  if(--controlCountdown < 0) {
+    controlCountdown = CONTROL_BLOCK-1;
+    if(pendingApp != NULL && !appFade.Active() && outgoingApp == NULL) {
+      AnalogOut* outs[2*NUM_WORDS];
+      for(int i=0;i<NUM_WORDS;i++) {
+        outs[2*i] = hw.voctOut[i];
+        outs[2*i+1] = hw.cvOut[i];
+      }
+      appFade.Start(app, pendingApp, outs, 2*NUM_WORDS);
+      outgoingApp = app;
+      app = pendingApp;
+      pendingApp = NULL;
+    }
+    // the routes are already the next app's while it waits
+    if(pendingApp == NULL) {
+#ifdef AUDIO_REPORT
+      uint32_t start = systick_hw->cvr;
+#endif
+      mods.Process(app);
+#ifdef AUDIO_REPORT
+      uint32_t cycles = (start - systick_hw->cvr) & 0x00FFFFFF;
+      modCycles += cycles;
+      if(cycles > modWorst) modWorst = cycles;
+      modBlocks++;
+#endif
+    }
+    if(appFade.Active()) appFade.ProcessControl();
+    else app->ProcessControl();
+  }
+  if(appFade.Active()) appFade.Process();
+  else app->Process();
+}
+
+// the app the UI last handed over, whether or not audio has it yet
+App* newestApp() {
+  App* next = pendingApp;
+  return next != NULL ? next : app;
+}
+
+// deletes the faded out app, once its fade is done
+void collectApp() {
+  App* oldApp = outgoingApp;
+  if(oldApp == NULL || appFade.Active()) return;
+  outgoingApp = NULL;
+  delete oldApp;
+  hw.ResetAudioStats();
+}
+
+// the audio side picks the new app up at the next control block, once any
+// fade before it is done, and fades over to it; the loop deletes the old
+// one afterwards, so this never waits. An app handed over but not picked up
+// yet is dropped for the new one
+void switchApp(App* nextApp) {
+  collectApp();
+  uint32_t ints = save_and_disable_interrupts();
+  App* stale = pendingApp;
+  pendingApp = NULL;
+  restore_interrupts(ints);
+  if(stale != NULL) delete stale;
+  // routes name parameters by index, which mean nothing to the next app
+  mods.Clear();
+  patchBus.Clear();
+  nextApp->UpdateInternals();
+  pendingApp = nextApp;
+}
+
+#ifdef AUDIO_REPORT
+// once a second over USB serial: the longest audio interrupt for the
+// running app, and the SRAM taken by initialised data plus code placed
+// with AUDIO_FUNC (both live in .data) and by .bss. build once more with
+// AUDIO_CODE_IN_FLASH for the before/after
+extern "C" char __data_start__[], __data_end__[], __bss_start__[], __bss_end__[];
+uint32_t lastReportUs = 0;
+void audioReport() {
+  if(time_us_32() - lastReportUs < 1000000) return;
+  lastReportUs = time_us_32();
+  Serial.printf("%s isr worst %luus of %dus, ram data+code %u bss %u\n",
+    APPS[appIndex%NUM_APPS].name, (unsigned long)TLWHardware::_isrWorstUs_, hw.timerInterval,
+    (unsigned)(__data_end__ - __data_start__), (unsigned)(__bss_end__ - __bss_start__));
+  // mean cycles a sample for each word type that ran, per word
+  for(int i=0;i<NUM_WORD_TYPES;i++) {
+    uint32_t runs = ThreeLittleWords::wordRuns[i];
+    if(runs == 0) continue;
+    Serial.printf("  %s %lu cycles\n", WORDS[i].name, (unsigned long)(ThreeLittleWords::wordCycles[i]/runs));
+    ThreeLittleWords::wordCycles[i] = 0;
+    ThreeLittleWords::wordRuns[i] = 0;
+  }
+  if(modBlocks > 0) {
+    Serial.printf("  mods %lu cycles a block, worst %lu\n", (unsigned long)(modCycles/modBlocks), (unsigned long)modWorst);
+    modCycles = 0;
+    modWorst = 0;
+    modBlocks = 0;
+  }
+  // what the last app or word crossfade cost while both sides ran
+  if(Crossfade::costToReport) {
+    Serial.printf("  crossfade %d%% of the sample period\n", Crossfade::lastCostPercent);
+    Crossfade::costToReport = false;
+  }
+  // recall against its 1ms target, and how long a flash write has held
+  // audio off since the last report
+  if(recallWorstUs > 0 || TLWHardware::_flashStallUs_ > 0) {
+    Serial.printf("  recall worst %luus, flash stall worst %luus\n",
+      (unsigned long)recallWorstUs, (unsigned long)TLWHardware::_flashStallUs_);
+    recallWorstUs = 0;
+    TLWHardware::_flashStallUs_ = 0;
+  }
+  // the voice pool's budget: a full pool of NUM_VOICES against the cycles
+  // in one sample period
+  if(poolSamples > 0 && poolVoices > 0) {
+    uint32_t perVoice = poolCycles/poolVoices;
+    uint32_t budget = (uint32_t)(clock_get_hz(clk_sys)/1000000)*hw.timerInterval;
+    Serial.printf("  voices %lu cycles a sample, %lu a voice, %d of them %lu%% of %lu\n",
+      (unsigned long)(poolCycles/poolSamples), (unsigned long)perVoice, NUM_VOICES,
+      (unsigned long)((perVoice*NUM_VOICES*100)/budget), (unsigned long)budget);
+    poolCycles = 0;
+    poolVoices = 0;
+    poolSamples = 0;
+  }
 }
+#endif
 
 App* getAppByIndex(int index) {
-  switch(index) {
-    case 0:
-      return new ThreeLittleWords();
-    case 1:
-      return new Harnomia();
-    case 2:
-      return new Drums();
-    case 3:
-      return new OutputCalibrator();
-    default:
-      return getAppByIndex(index%4);
+  const AppEntry& entry = APPS[index%NUM_APPS];
+  return applyDefaults(entry, entry.make(NULL));
+}
+
+void savePreset(int slot) {
+  static uint8_t data[PRESET_DATA_SIZE];
+  PresetWriter w(data, PRESET_DATA_SIZE);
+  newestApp()->SavePreset(w);
+  mods.SavePreset(w);
+  patchBus.SavePreset(w);
+  if(w.ok) presets.Save(slot, appIndex%NUM_APPS, data, w.length);
+}
+
+// the record is read in place from the memory mapped flash. Another app is
+// built and loaded before it's handed over, so recall never waits on audio
+void recallPreset(int slot) {
+  const PresetRecord* record = presets.Find(slot);
+  if(record == NULL || record->app >= NUM_APPS) return;
+  PresetReader r(record->data, record->length);
+  if(record->app != appIndex%NUM_APPS) {
+    appIndex = record->app;
+    App* next = getAppByIndex(appIndex);
+    next->LoadPreset(r);
+    switchApp(next);
+  } else {
+    newestApp()->LoadPreset(r);
   }
+  mods.LoadPreset(r);
+  patchBus.LoadPreset(r);
 }
 
+// audio and the trigger inputs come up first, then the display behind
+// them; the splash no longer holds up setup and just stays on screen for
+// its two seconds, showing how long the first sample took
+uint32_t splashUntil = 0;
+
 void setup() {
   char buffer[64];
 
   set_sys_clock_khz(250000, true);
+#ifdef AUDIO_REPORT
+  Serial.begin(115200);
+  // free running off the system clock, for the per-word cycle counts
+  systick_hw->rvr = 0x00FFFFFF;
+  systick_hw->csr = 0x5;
+#endif
 
-  INIT_FPMATH();
-  app = getAppByIndex(0);
+  presets.Init(&hw);
+  if(presets.lastSlot >= 0) {
+    presetSlot = presets.lastSlot;
+    appIndex = presets.Find(presetSlot)->app;
+  }
+  app = getAppByIndex(appIndex);
   hw.Init(audio_callback);
+  app->UpdateInternals();
+  // words swap in under the audio side, so this waits for hw.Init
+  recallPreset(presetSlot);
 
-  hw.display->setFont(u8g2_font_pixzillav1_tf);
-  hw.display->setFontRefHeightExtendedText();
-  hw.display->setDrawColor(1);
-  hw.display->setFontPosTop();
-  hw.display->setFontDirection(0);
+  hw.InitDisplay();
   hw.display->clearBuffer();
   sprintf(buffer, "i love you");
   hw.display->drawStr(20, 28, buffer);
+  hw.display->setFont(u8g2_font_threepix_tr);
+  sprintf(buffer, "first sample %lu us", (unsigned long)TLWHardware::_firstSampleUs_);
+  hw.display->drawStr(20, 54, buffer);
   hw.display->sendBuffer();
-  sleep_ms(2000);
+  splashUntil = time_us_32() + 2000000;
 }
 
 void loop() {
   hw.Update();
+  if((int32_t)(time_us_32() - splashUntil) < 0) return;
 
-  /*
   if(hw.control[0]->topButtonPressed()) {
-    hw.SetAudioCallback(NULL);
-    sleep_ms(10);
-    delete app;
-    app = getAppByIndex(++appIndex);
-    hw.SetAudioCallback(audio_callback);
+    switchApp(getAppByIndex(++appIndex));
+  }
+  if(hw.control[1]->topButtonPressed()) {
+    savePreset(presetSlot);
+  }
+  if(hw.control[2]->topButtonPressed()) {
+    presetSlot = (presetSlot + 1) % PRESET_SLOTS;
+#ifdef AUDIO_REPORT
+    uint32_t start = time_us_32();
+#endif
+    recallPreset(presetSlot);
+#ifdef AUDIO_REPORT
+    uint32_t elapsed = time_us_32() - start;
+    if(elapsed > recallWorstUs) recallWorstUs = elapsed;
+#endif
   }
-  */
 
   hw.display->setFont(u8g2_font_pixzillav1_tf);
   hw.display->setFontRefHeightExtendedText();
@@ -72,11 +249,16 @@ void loop() {
   hw.display->setFontPosTop();
   hw.display->setFontDirection(0);
   hw.display->clearBuffer();
-  app->UpdateParams();
-  if(app->ParamsHaveChanged()) {
-    app->UpdateInternals();
-  }
-  app->UpdateDisplay();
-  app->DrawParams();
+  collectApp();
+  // an app waiting on a fade is already the one being edited
+  App* shown = newestApp();
+  shown->SyncParams();
+  shown->UpdateParams();
+  shown->DispatchParamChanges();
+  shown->UpdateDisplay();
+  shown->DrawParams();
   hw.display->sendBuffer();
+#ifdef AUDIO_REPORT
+  audioReport();
+#endif
 }
@@ -2,7 +2,53 @@
 #define UTILS_H
 
 #include "pico/stdlib.h"
+#include "hardware/sync.h"
 #include <math.h>
 #include "constants.h"
 
+uint32_t fnv1a(const void* data, size_t len) {
+  const uint8_t* bytes = (const uint8_t*)data;
+  uint32_t hash = 2166136261u;
+  for(size_t i=0;i<len;i++) hash = (hash ^ bytes[i]) * 16777619u;
+  return hash;
+}
+
+// Hands a copy of T from one side to the other without either waiting. The
+// writer makes seq odd, copies, then makes it even again; a reader that sees
+// an odd or moving seq keeps what it has and tries again on its next pass.
+// Fine for the UI loop against the audio ISR in either direction.
+template<class T>
+class Seqlock {
+public:
+  volatile uint32_t seq;
+  T data;
+  // where Read copies to before it knows the copy is whole; a member rather
+  // than a local so a big T stays off the ISR's stack. Each Seqlock has one
+  // reader, so one is enough
+  T copy;
+  Seqlock() {
+    this->seq = 0;
+  }
+  void AUDIO_FUNC(Write)(const T& v) {
+    seq = seq + 1;
+    __dmb();
+    data = v;
+    __dmb();
+    seq = seq + 1;
+  }
+  // copies into v if there's been a whole write since lastSeq; v is left
+  // alone otherwise
+  bool AUDIO_FUNC(Read)(T& v, uint32_t& lastSeq) {
+    uint32_t s = seq;
+    if((s & 1) || s == lastSeq) return false;
+    __dmb();
+    copy = data;
+    __dmb();
+    if(seq != s) return false;
+    v = copy;
+    lastSeq = s;
+    return true;
+  }
+};
+
 #endif
@@ -0,0 +1,165 @@
+#ifndef VOICES_H
+#define VOICES_H
+
+#include "fpmath.h"
+#include "constants.h"
+#include "dsp.h"
+#ifdef AUDIO_REPORT
+#include "hardware/structs/systick.h"
+#endif
+
+// Each active voice is a phasor, a saw and a linear envelope. The count is
+// a budget, not a musical limit: AUDIO_REPORT builds print the pool's
+// cycles a sample and a sounding voice, and what a full pool takes of the
+// sample period. Set it per build with -DNUM_VOICES=... to the most that
+// keep a full pool well under 10%. Harnomia plays chords of up to this
+// many voices, less its outputs' voices, and shows when it cuts one short.
+#ifndef NUM_VOICES
+#define NUM_VOICES 8
+#endif
+
+#ifdef AUDIO_REPORT
+// SysTick cycles in VoicePool::Process and the voices sounding, summed
+// over samples since the last report
+volatile uint32_t poolCycles = 0;
+volatile uint32_t poolVoices = 0;
+volatile uint32_t poolSamples = 0;
+#endif
+
+class Voice {
+public:
+  Phasor phasor;
+  int key;
+  bool gate;
+  bool claimed;
+  uint32_t age;
+  fp_signed level;
+  fp_signed attackDelta;
+  fp_signed releaseDelta;
+  fp_signed out;
+  Voice() {
+    this->key = -1;
+    this->gate = false;
+    this->claimed = false;
+    this->age = 0;
+    this->level = 0;
+    this->attackDelta = FP_UNITY;
+    this->releaseDelta = FP_UNITY;
+    this->out = 0;
+  }
+  bool IsActive() { return gate || level > 0; }
+  void SetEnvelope(uint32_t attackMs, uint32_t releaseMs) {
+    attackDelta = max(1, (int)((FP_UNITY*1000)/(SAMPLERATE*max(attackMs, (uint32_t)1))));
+    releaseDelta = max(1, (int)((FP_UNITY*1000)/(SAMPLERATE*max(releaseMs, (uint32_t)1))));
+  }
+  fp_signed AUDIO_FUNC(Process)() {
+    if(gate) {
+      level += attackDelta;
+      if(level > FP_UNITY) level = FP_UNITY;
+    } else if(level > 0) {
+      level -= releaseDelta;
+      if(level < 0) level = 0;
+    } else {
+      out = 0;
+      return out;
+    }
+    fp_signed saw = (phasor.Process() >> (31-FP_BITS)) - FP_UNITY;
+    out = FP_MUL(saw, level);
+    return out;
+  }
+};
+
+template<int N>
+class VoicePool {
+public:
+  Voice voices[N];
+  uint32_t clock;
+  fp_signed mixGain;
+  VoicePool() {
+    this->clock = 0;
+    this->mixGain = FP_UNITY/N;
+  }
+
+  void SetEnvelope(uint32_t attackMs, uint32_t releaseMs) {
+    for(int i=0;i<N;i++) voices[i].SetEnvelope(attackMs, releaseMs);
+  }
+
+  int AUDIO_FUNC(Find)(int key) {
+    for(int i=0;i<N;i++) {
+      if(voices[i].key == key && voices[i].IsActive()) return i;
+    }
+    return -1;
+  }
+
+  // free voices first, then the quietest released voice, then the oldest
+  // held one. A voice claimed since BeginUpdate is never taken, so an
+  // update asking for more than N notes drops the extra ones rather than
+  // stealing back and forth inside itself; -1 when nothing is left
+  int AUDIO_FUNC(Allocate)() {
+    int quietest = -1;
+    int oldest = -1;
+    for(int i=0;i<N;i++) {
+      if(!voices[i].IsActive()) return i;
+      if(voices[i].claimed) continue;
+      if(!voices[i].gate && (quietest < 0 || voices[i].level < voices[quietest].level)) quietest = i;
+      if(oldest < 0 || voices[i].age < voices[oldest].age) oldest = i;
+    }
+    return quietest >= 0 ? quietest : oldest;
+  }
+
+  int AUDIO_FUNC(NoteOn)(int key, fp_signed freq) {
+    int i = Find(key);
+    if(i < 0) {
+      i = Allocate();
+      if(i < 0) return -1;
+      voices[i].key = key;
+      voices[i].age = ++clock;
+      voices[i].phasor.phase = 0;
+    }
+    voices[i].phasor.SetFreq(freq);
+    voices[i].gate = true;
+    voices[i].claimed = true;
+    return i;
+  }
+
+  void NoteOff(int key) {
+    int i = Find(key);
+    if(i >= 0) voices[i].gate = false;
+  }
+
+  void AllNotesOff() {
+    for(int i=0;i<N;i++) voices[i].gate = false;
+  }
+
+  // voices not claimed by a NoteOn between BeginUpdate and EndUpdate are released
+  void AUDIO_FUNC(BeginUpdate)() {
+    for(int i=0;i<N;i++) voices[i].claimed = false;
+  }
+  void AUDIO_FUNC(EndUpdate)() {
+    for(int i=0;i<N;i++) {
+      if(!voices[i].claimed) voices[i].gate = false;
+      voices[i].claimed = false;
+    }
+  }
+
+  fp_signed AUDIO_FUNC(VoiceOut)(int i, int key) {
+    return (i >= 0 && voices[i].key == key) ? voices[i].out : 0;
+  }
+
+  fp_signed AUDIO_FUNC(Process)() {
+#ifdef AUDIO_REPORT
+    uint32_t start = systick_hw->cvr;
+#endif
+    fp_signed mix = 0;
+    for(int i=0;i<N;i++) mix += voices[i].Process();
+    mix = FP_MUL(mix, mixGain);
+#ifdef AUDIO_REPORT
+    poolCycles += (start - systick_hw->cvr) & 0x00FFFFFF;
+    for(int i=0;i<N;i++) poolVoices += voices[i].IsActive();
+    poolSamples++;
+#endif
+    return mix;
+  }
+};
+
+#endif